@@ -3,8 +3,13 @@
 -- 此为客户端利用sqlite保存的内容
 -- 目前先就只保存游戏数据
 
-PRAGMA auto_vacuum = FULL;
-PRAGMA incremental_vacuum(5);
+-- FULL 模式每次删除都要挪页，改为 INCREMENTAL，空闲页由 DbMaintainer
+-- 在大厅空闲时分批回收；两种模式之间可以随时切换
+PRAGMA auto_vacuum = INCREMENTAL;
+-- WAL：后台维护连接读写时不挡住主连接
+PRAGMA journal_mode = WAL;
+-- 主连接上少做几次自动checkpoint，平时由 DbMaintainer 在空闲时做
+PRAGMA wal_autocheckpoint = 4000;
 
 CREATE TABLE IF NOT EXISTS myGameData (
   id INTEGER PRIMARY KEY AUTOINCREMENT,
@@ -18,18 +23,18 @@ CREATE TABLE IF NOT EXISTS myGameData (
   result INTEGER           -- 游戏的胜负 1=胜 2=负 3=平
 );
 
+-- 战绩分页查询用的索引：WHERE pid = ? AND server_addr = ? AND id < ? ORDER BY id DESC
+CREATE INDEX IF NOT EXISTS myGameData_owner ON myGameData (pid, server_addr, id);
+
 -- 自动保存录像：录像文件直接以blob形式存于数据库
 CREATE TABLE IF NOT EXISTS myGameRecordings (
   id INTEGER PRIMARY KEY, -- gameData id
   recording BLOB          -- 录像文件的内容
 );
 
--- 利用trigger自动删除，只保留近5000局录像
-CREATE TRIGGER IF NOT EXISTS deleteOldRecordings AFTER INSERT ON myGameRecordings
-BEGIN
-  DELETE FROM myGameRecordings WHERE id NOT IN
-    (SELECT id FROM myGameRecordings ORDER BY id DESC LIMIT 5000);
-END;
+-- 旧版本用trigger在每次插入后 NOT IN 全表删除，现改由 RecordingRetention
+-- 在后台按id区间分批清理（见 src/client/retention.cpp）
+DROP TRIGGER IF EXISTS deleteOldRecordings;
 
 -- 自动保存复盘资料
 CREATE TABLE IF NOT EXISTS myGameRoomData (
@@ -37,11 +42,88 @@ CREATE TABLE IF NOT EXISTS myGameRoomData (
   room_data BLOB          -- 录像文件的内容
 );
 
--- 利用trigger自动删除，只保留近50000局的终局复盘
-CREATE TRIGGER IF NOT EXISTS deleteOldRoomData AFTER INSERT ON myGameRoomData
+DROP TRIGGER IF EXISTS deleteOldRoomData;
+
+-- 客户端自己的一些键值状态，例如清理录像的水位线
+CREATE TABLE IF NOT EXISTS clientMeta (
+  key VARCHAR(64) PRIMARY KEY,
+  value INTEGER
+);
+
+-- 录像与复盘资料的字节数，按总大小清理时用，免得去读blob本体
+CREATE TABLE IF NOT EXISTS myGameBlobSize (
+  id INTEGER PRIMARY KEY, -- gameData id
+  recording INTEGER NOT NULL DEFAULT 0,
+  room_data INTEGER NOT NULL DEFAULT 0
+);
+
+CREATE TRIGGER IF NOT EXISTS trackRecordingSize AFTER INSERT ON myGameRecordings
+BEGIN
+  INSERT INTO myGameBlobSize (id, recording) VALUES (new.id, length(new.recording))
+    ON CONFLICT(id) DO UPDATE SET recording = excluded.recording;
+END;
+
+CREATE TRIGGER IF NOT EXISTS trackRecordingSizeUpdate AFTER UPDATE OF recording ON myGameRecordings
+BEGIN
+  UPDATE myGameBlobSize SET recording = length(new.recording) WHERE id = new.id;
+END;
+
+CREATE TRIGGER IF NOT EXISTS trackRoomDataSize AFTER INSERT ON myGameRoomData
+BEGIN
+  INSERT INTO myGameBlobSize (id, room_data) VALUES (new.id, length(new.room_data))
+    ON CONFLICT(id) DO UPDATE SET room_data = excluded.room_data;
+END;
+
+CREATE TRIGGER IF NOT EXISTS trackRoomDataSizeUpdate AFTER UPDATE OF room_data ON myGameRoomData
+BEGIN
+  UPDATE myGameBlobSize SET room_data = length(new.room_data) WHERE id = new.id;
+END;
+
+-- 老数据库补一次大小统计；length()只读记录头，不会把blob读出来
+INSERT OR IGNORE INTO myGameBlobSize (id, recording, room_data)
+  SELECT g.id, coalesce(length(r.recording), 0), coalesce(length(d.room_data), 0)
+  FROM myGameData g
+    LEFT JOIN myGameRecordings r ON r.id = g.id
+    LEFT JOIN myGameRoomData d ON d.id = g.id
+  WHERE NOT EXISTS (SELECT 1 FROM clientMeta WHERE key = 'blob_size_backfilled')
+    AND (r.id IS NOT NULL OR d.id IS NOT NULL);
+INSERT OR IGNORE INTO clientMeta (key, value) VALUES ('blob_size_backfilled', 1);
+
+-- 战绩统计：按 玩家/服务器/模式/武将/身份 分组累计胜负平
+-- 由 updateGameStats 在插入 myGameData 的同一语句内维护，查询只需扫分组数
+CREATE TABLE IF NOT EXISTS myGameStats (
+  pid INTEGER NOT NULL,
+  server_addr VARCHAR(16) NOT NULL,
+  mode VARCHAR(16) NOT NULL,
+  general VARCHAR(16) NOT NULL,
+  role VARCHAR(8) NOT NULL,
+  wins INTEGER NOT NULL DEFAULT 0,
+  losses INTEGER NOT NULL DEFAULT 0,
+  draws INTEGER NOT NULL DEFAULT 0,
+  PRIMARY KEY (pid, server_addr, mode, general, role)
+);
+
+-- 老数据库从 myGameData 补算一次，之后交给trigger
+INSERT OR IGNORE INTO myGameStats
+  (pid, server_addr, mode, general, role, wins, losses, draws)
+  SELECT coalesce(pid, 0), coalesce(server_addr, ''), coalesce(mode, ''),
+    coalesce(general, ''), coalesce(role, ''),
+    SUM(result = 1), SUM(result = 2), SUM(result = 3)
+  FROM myGameData
+  WHERE NOT EXISTS (SELECT 1 FROM clientMeta WHERE key = 'stats_backfilled')
+  GROUP BY 1, 2, 3, 4, 5;
+INSERT OR IGNORE INTO clientMeta (key, value) VALUES ('stats_backfilled', 1);
+
+CREATE TRIGGER IF NOT EXISTS updateGameStats AFTER INSERT ON myGameData
 BEGIN
-  DELETE FROM myGameRoomData WHERE id NOT IN
-    (SELECT id FROM myGameRoomData ORDER BY id DESC LIMIT 50000);
+  INSERT INTO myGameStats (pid, server_addr, mode, general, role, wins, losses, draws)
+    VALUES (coalesce(new.pid, 0), coalesce(new.server_addr, ''), coalesce(new.mode, ''),
+      coalesce(new.general, ''), coalesce(new.role, ''),
+      new.result = 1, new.result = 2, new.result = 3)
+    ON CONFLICT(pid, server_addr, mode, general, role) DO UPDATE SET
+      wins = wins + excluded.wins,
+      losses = losses + excluded.losses,
+      draws = draws + excluded.draws;
 END;
 
 CREATE TABLE IF NOT EXISTS starredRecording (
@@ -49,3 +131,28 @@ CREATE TABLE IF NOT EXISTS starredRecording (
   replay_name VARCHAR(24) PRIMARY KEY, -- 对应录像文件的名字 在recording/下（保存录像按钮）
   my_comment VARCHAR(24)   -- 评语
 );
+
+-- 录像库：录像文件和自动保存录像的文件头信息，列表界面直接读这里，不必逐个打开录像
+-- 文件按 mtime/size 判断是否需要重新解析；由 RecordingIndex 在后台维护
+CREATE TABLE IF NOT EXISTS recordingLibrary (
+  source VARCHAR(8),      -- 'file' 或 'db'
+  ref VARCHAR(255),       -- 文件名 或 gameData id
+  mtime INTEGER,
+  size INTEGER,
+  version VARCHAR(32),
+  name VARCHAR(255),
+  mode VARCHAR(64),
+  room_settings TEXT,     -- JSON
+  player_info TEXT,       -- JSON
+  first_ts INTEGER,       -- 第一个/最后一个事件的时间戳，毫秒
+  last_ts INTEGER,
+  PRIMARY KEY (source, ref)
+);
+
+-- blob 压缩用的共享字典（见 blob_codec.h），由 DbMaintainer 训练，按 id 引用，不删
+CREATE TABLE IF NOT EXISTS blobDictionary (
+  id INTEGER PRIMARY KEY AUTOINCREMENT,
+  kind VARCHAR(16),     -- 用于哪种数据，目前只有 'room_data'
+  data BLOB,
+  created INTEGER
+);
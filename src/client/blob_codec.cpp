@@ -0,0 +1,145 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "client/blob_codec.h"
+
+static const QByteArray Magic = QByteArrayLiteral("FKD1");
+
+static void putVarint(QByteArray &out, quint64 v) {
+  while (v >= 0x80) {
+    out.append(char(v | 0x80));
+    v >>= 7;
+  }
+  out.append(char(v));
+}
+
+// 越界或格式不对时 ok 置 false
+static quint64 getVarint(const char *&p, const char *end, bool &ok) {
+  quint64 v = 0;
+  for (int shift = 0; ok && shift < 64 && p < end; shift += 7) {
+    auto b = (uchar)*p++;
+    v |= quint64(b & 0x7f) << shift;
+    if (!(b & 0x80)) return v;
+  }
+  ok = false;
+  return 0;
+}
+
+static size_t blockHash(const char *p) {
+  return qHashBits(p, BlobCodec::MinMatch);
+}
+
+bool BlobCodec::isDict(const QByteArray &raw) {
+  return raw.size() > Magic.size() && raw.startsWith(Magic);
+}
+
+qint64 BlobCodec::dictId(const QByteArray &raw) {
+  if (!isDict(raw)) return -1;
+  const char *p = raw.constData() + Magic.size();
+  bool ok = true;
+  auto id = getVarint(p, raw.constData() + raw.size(), ok);
+  return ok ? qint64(id) : -1;
+}
+
+QByteArray BlobCodec::train(const QList<QByteArray> &samples, int size) {
+  // 每个样本按 MinMatch 对齐切块，统计每块出现在多少个样本里
+  QList<QSet<size_t>> blocks;
+  QHash<size_t, int> count;
+  for (auto &s : samples) {
+    QSet<size_t> set;
+    for (qsizetype i = 0; i + MinMatch <= s.size(); i += MinMatch) {
+      set.insert(blockHash(s.constData() + i));
+    }
+    for (auto h : set) count[h]++;
+    blocks << set;
+  }
+
+  QList<QPair<qint64, int>> scored;
+  for (int i = 0; i < samples.size(); i++) {
+    qint64 score = 0;
+    for (auto h : blocks[i]) score += count[h] - 1;
+    if (score > 0) scored << qMakePair(score, i);
+  }
+  std::sort(scored.begin(), scored.end(), std::greater<QPair<qint64, int>>());
+
+  // 大部分内容字典里已经有了的样本就不要了
+  QByteArray dict;
+  QSet<size_t> covered;
+  for (auto &[score, i] : scored) {
+    if (dict.size() >= size) break;
+    auto &set = blocks[i];
+    int known = 0;
+    for (auto h : set) known += covered.contains(h);
+    if (!set.isEmpty() && known * 10 >= set.size() * 9) continue;
+    dict += samples[i].left(size - dict.size());
+    covered.unite(set);
+  }
+  return dict;
+}
+
+QByteArray BlobCodec::compress(const QByteArray &data, const QByteArray &dict, qint64 id) {
+  QHash<size_t, int> table;
+  table.reserve(dict.size());
+  for (qsizetype i = 0; i + MinMatch <= dict.size(); i++) {
+    table.insert(blockHash(dict.constData() + i), i);
+  }
+
+  QByteArray ops;
+  qsizetype i = 0, literal = 0, n = data.size();
+  auto flushLiteral = [&](qsizetype end) {
+    if (end <= literal) return;
+    putVarint(ops, quint64(end - literal) << 1);
+    ops.append(data.constData() + literal, end - literal);
+  };
+
+  while (i + MinMatch <= n) {
+    auto it = table.constFind(blockHash(data.constData() + i));
+    if (it == table.cend() ||
+        memcmp(dict.constData() + *it, data.constData() + i, MinMatch) != 0) {
+      i++;
+      continue;
+    }
+    qsizetype off = *it, len = MinMatch;
+    while (i + len < n && off + len < dict.size() && data.at(i + len) == dict.at(off + len))
+      len++;
+    flushLiteral(i);
+    putVarint(ops, (quint64(len) << 1) | 1);
+    putVarint(ops, off);
+    i += len;
+    literal = i;
+  }
+  flushLiteral(n);
+
+  QByteArray out = Magic;
+  putVarint(out, id);
+  out += qCompress(ops, 9);
+  return out;
+}
+
+QByteArray BlobCodec::decompress(const QByteArray &raw, const QByteArray &dict) {
+  if (!isDict(raw)) return qUncompress(raw);
+
+  const char *p = raw.constData() + Magic.size();
+  const char *end = raw.constData() + raw.size();
+  bool ok = true;
+  getVarint(p, end, ok);
+  if (!ok) return QByteArray();
+  auto ops = qUncompress(QByteArray::fromRawData(p, end - p));
+
+  QByteArray out;
+  p = ops.constData();
+  end = p + ops.size();
+  while (ok && p < end) {
+    auto op = getVarint(p, end, ok);
+    auto len = op >> 1;
+    if (op & 1) {
+      auto off = getVarint(p, end, ok);
+      if (!ok || off > quint64(dict.size()) || len > quint64(dict.size()) - off) return QByteArray();
+      out.append(dict.constData() + off, len);
+    } else {
+      if (!ok || len > quint64(end - p)) return QByteArray();
+      out.append(p, len);
+      p += len;
+    }
+  }
+  return ok ? out : QByteArray();
+}
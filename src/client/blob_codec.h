@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _BLOB_CODEC_H
+#define _BLOB_CODEC_H
+
+/**
+  带共享字典的 blob 压缩，给 myGameRoomData 这种彼此高度相似的数据用。
+
+  qCompress 每块单独压缩，看不到块与块之间的重复。这里先对照一份共享字典做
+  差分（从字典里复制片段 / 原样插入），再把差分结果 qCompress：
+
+  ```
+  "FKD1" | varint 字典id | qCompress(
+      指令 * N：varint (长度 << 1 | 是否复制)，复制的后跟 varint 字典偏移，
+                插入的后跟原始字节)
+  ```
+
+  字典存在 blobDictionary 表里，按 id 引用。没有 "FKD1" 标记的是原来的
+  qCompress 数据，decompress() 照样能解。
+  */
+class BlobCodec {
+public:
+  static constexpr int DictSize = 64 * 1024;
+  static constexpr int MinMatch = 16;
+
+  static bool isDict(const QByteArray &raw);
+  // 不是字典压缩的返回 -1
+  static qint64 dictId(const QByteArray &raw);
+
+  // 从未压缩的样本里挑出和其他样本重复最多的，拼成不超过 size 的字典
+  static QByteArray train(const QList<QByteArray> &samples, int size = DictSize);
+  static QByteArray compress(const QByteArray &data, const QByteArray &dict, qint64 id);
+  // 出错返回空
+  static QByteArray decompress(const QByteArray &raw, const QByteArray &dict);
+};
+
+#endif // _BLOB_CODEC_H
@@ -2,8 +2,16 @@
 
 #include "client/client.h"
 #include "client/clientplayer.h"
+#include "client/game_history.h"
+#include "client/retention.h"
+#include "client/db_maintainer.h"
+#include "client/recording_index.h"
+#include "client/recording_journal.h"
+#include "client/spectator_buffer.h"
+#include "client/replay_format.h"
 #include "core/c-wrapper.h"
 #include "core/util.h"
+#include "core/manifest.h"
 #include "network/client_socket.h"
 #include "network/router.h"
 #include "ui/qmlbackend.h"
@@ -20,17 +28,25 @@ struct ClientPrivate {
   ~ClientPrivate() { RSA_free(rsa); }
 };
 
-Client::Client(QObject *parent) : QObject(parent) {
+Client::Client(QObject *parent, bool replayOnly) : QObject(parent) {
   ClientInstance = this;
   self = new ClientPlayer(0, this);
 
   ClientSocket *socket = new ClientSocket;
   connect(socket, &ClientSocket::error_message, this, &Client::error_message);
   router = new Router(this, socket, Router::TYPE_CLIENT);
+  // 旁观时的通知先经过缓冲，见 spectator_buffer.h
+  spectator = new SpectatorBuffer(this);
+  connect(spectator, &SpectatorBuffer::command_ready, this,
+          [this](const QByteArray &c, const QByteArray &j) { callLua(c, j, false); });
   connect(router, &Router::notification_got, this, [&](const QByteArray &c, const QByteArray &j) {
-    callLua(c, j, false);
+    journalEvent(c, j, false);
+    if (!spectator->push(c, j, false))
+      callLua(c, j, false);
   });
   connect(router, &Router::request_got, this, [&](const QByteArray &c, const QByteArray &j) {
+    journalEvent(c, j, true);
+    spectator->push(c, j, true);
     callLua(c, j, true);
   });
 
@@ -51,7 +67,43 @@ Client::Client(QObject *parent) : QObject(parent) {
   // 确保在初始化完成后切回游戏根目录，避免后续操作中的路径问题
   QDir::setCurrent(originalPath);
 
+  if (replayOnly) {
+    // 几个进程同时验证录像也互不影响
+    scratch = std::make_unique<QTemporaryDir>();
+    db = std::make_unique<Sqlite3>(scratch->filePath("client.db"), "./client/init.sql");
+    return;
+  }
+
   db = std::make_unique<Sqlite3>("./client/client.db", "./client/init.sql");
+
+  // 清理旧录像和数据库维护都放到后台线程；用绝对路径，Lua那边随时可能cd走
+  auto dbPath = QFileInfo("./client/client.db").absoluteFilePath();
+  maintainer = new DbMaintainer(dbPath, this);
+  retention = new RecordingRetention(dbPath, this);
+  recordingIndex = new RecordingIndex(dbPath, QFileInfo("recording").absoluteFilePath(), this);
+  QFile conf("herokill.client.config.json");
+  if (conf.open(QIODevice::ReadOnly)) {
+    retention->loadLimits(QJsonDocument::fromJson(conf.readAll()).object());
+    conf.close();
+  }
+  // 清理掉的录像也要从录像库和检索里去掉
+  connect(retention, &RecordingRetention::cleaned,
+          recordingIndex, &RecordingIndex::purgeGames);
+  retention->schedule();
+
+  journal = new RecordingJournal(dbPath, QFileInfo("client/journal").absoluteFilePath(),
+                                 QFileInfo("recording").absoluteFilePath(), this);
+  connect(journal, &RecordingJournal::committed, this, [this](int id, const QByteArray &raw) {
+    retention->schedule();
+    auto ret = db->select(QString("SELECT mode, general, deputy_general FROM myGameData "
+                                  "WHERE id = %1;").arg(id));
+    auto row = ret.isEmpty() ? QMap<QString, QString>() : ret[0];
+    recordingIndex->addGame(id, row["mode"], row["general"], row["deputy_general"], raw);
+  });
+  connect(journal, &RecordingJournal::recovered, recordingIndex, &RecordingIndex::addFile);
+  connect(journal, &RecordingJournal::fileSaved, recordingIndex, &RecordingIndex::addFile);
+  journal->recover();
+  recordingIndex->reconcile();
 }
 
 Client::~Client() {
@@ -131,14 +183,19 @@ QByteArray Client::pubEncrypt(const QByteArray &key, const QByteArray &data) {
 
 void Client::sendSetupPacket(const QString &pubkey) {
   auto cipherText = pubEncrypt(pubkey.toUtf8(), password.toUtf8());
-  auto md5 = calcFileMD5();
 
-  QCborArray arr;
-  arr << screenName << cipherText << md5 << FK_VERSION << GetDeviceUuid();
-  // notifyServer("Setup", arr.toCborValue().toCbor());
-  int type =
-      Router::TYPE_NOTIFICATION | Router::SRC_CLIENT | Router::DEST_SERVER;
-  router->notify(type, "Setup", arr.toCborValue().toCbor());
+  // 清单是启动时在后台算的，这里只等结果
+  PackageManifest::login().then(this, [=, this](const PackageManifest::Login &login) {
+    QCborArray arr;
+    arr << screenName << cipherText << login.md5 << FK_VERSION << GetDeviceUuid();
+    // 检查更新时服务器表示认得新的清单格式，才附上各格式的摘要
+    if (!PackageManifest::negotiatedFormat().isEmpty())
+      arr << login.formats;
+    // notifyServer("Setup", arr.toCborValue().toCbor());
+    int type =
+        Router::TYPE_NOTIFICATION | Router::SRC_CLIENT | Router::DEST_SERVER;
+    router->notify(type, "Setup", arr.toCborValue().toCbor());
+  });
 }
 
 void Client::setupServerLag(qint64 server_time) {
@@ -192,7 +249,35 @@ void Client::notifyServer(const QString &command, const QVariant &jsonData) {
   router->notify(type, command.toUtf8(), QCborValue::fromVariant(v).toCbor());
 }
 
+void Client::journalEvent(const QByteArray &command, const QByteArray &data, bool isRequest) {
+  if (!journal) return;
+  if (command == "EnterRoom") {
+    // 在房间里等人的时候不记；重新进房间时上一局没保存的日志也不要了
+    roomSettings = data;
+    journal->abandon();
+  } else if (command == "EnterLobby") {
+    roomSettings.clear();
+    journal->abandon();
+  } else if (command == "StartGame") {
+    // 每局开始都重新开一个日志，同一个房间里连着打也一样
+    auto playerInfo = QCborArray({
+      self->getId(), self->getScreenName(), self->getAvatar()
+    }).toCborValue().toCbor();
+    journal->begin(roomSettings, playerInfo);
+  } else if (journal->isActive()) {
+    // 进房间和开始游戏由播放录像时自己补上
+    journal->append(QDateTime::currentMSecsSinceEpoch(), isRequest, command, data);
+  }
+}
+
 void Client::callLua(const QByteArray& command, const QByteArray& json_data, bool isRequest) {
+  // 只在大厅里做数据库维护，对局和看录像时不打扰
+  if (maintainer && command == "EnterLobby") {
+    maintainer->setIdle(true);
+  } else if (maintainer && (command == "EnterRoom" || command == "StartGame")) {
+    maintainer->setIdle(false);
+  }
+
   L->call("ClientCallback", { QVariant::fromValue(this), command, json_data, isRequest });
 }
 
@@ -254,7 +339,38 @@ QVariantList Client::getMyGameData() {
                  .arg(self->getId()).arg(router->getSocket()->peerAddress()));
 }
 
+QVariantList Client::getMyGameStats(const QString &groupBy, const QVariantMap &filter) {
+  auto q = gameStatsQueryFromVariant(groupBy, filter);
+  q.pid = self->getId();
+  q.serverAddr = router->getSocket()->peerAddress();
+  return execSql(buildGameStatsQuery(q));
+}
+
+QVariantList Client::searchRecordings(const QString &query, int limit) {
+  if (!recordingIndex) return {};
+  return execSql(RecordingIndex::buildSearchQuery(query, limit, recordingIndex->backend()));
+}
+
+QVariantList Client::getRecordingLibrary(const QString &source, int limit) {
+  return execSql(RecordingIndex::buildLibraryQuery(source, limit));
+}
+
+QVariantList Client::getMyGameHistory(int beforeId, int limit, const QVariantMap &filter) {
+  auto q = gameHistoryQueryFromVariant(filter);
+  q.pid = self->getId();
+  q.serverAddr = router->getSocket()->peerAddress();
+  q.beforeId = beforeId;
+  q.limit = limit;
+  return execSql(buildGameHistoryQuery(q));
+}
+
 void Client::saveRecord(const QByteArray &json, const QString &fname) {
+  // 编码要压缩再解回来核对，整局录像不小，交给录像日志的写线程
+  if (journal) {
+    journal->saveFile(fname + ".fk.rep", json);
+    return;
+  }
+
   if (!QDir("recording").exists()) {
     QDir(".").mkdir("recording");
   }
@@ -263,8 +379,9 @@ void Client::saveRecord(const QByteArray &json, const QString &fname) {
     qWarning() << "Failed to open file for writing:" << c.fileName();
     return;
   }
-  c.write(qCompress(json));
+  c.write(ReplayFormat::encode(json));
   c.close();
+  if (recordingIndex) recordingIndex->addFile(fname + ".fk.rep");
 }
 
 void Client::saveGameData(const QString &mode, const QString &general, const QString &deputy,
@@ -276,21 +393,52 @@ void Client::saveGameData(const QString &mode, const QString &general, const QSt
             "VALUES (%1, %2, '%3', '%4', '%5', '%6', '%7', %8);");
   static auto sqlAddBlob = QString("INSERT INTO myGameRoomData "
             "(id, room_data) VALUES (%1, x'%2');");
-  static auto sqlSaveRecord = QString("INSERT INTO myGameRecordings "
-            "(id, recording) VALUES (%1, x'%2');");
 
   auto time = QDateTime::currentSecsSinceEpoch();
   auto pid = self->getId();
   auto server_addr = router->getSocket()->peerAddress();
   auto blob = qCompress(room_data).toHex();
-  auto record_blob = qCompress(record).toHex();
-  db->exec(sqlAddGamaData.arg(time).arg(pid).arg(server_addr).arg(mode)
-    .arg(general).arg(deputy).arg(role).arg(result));
-
-  auto id_obj = db->select("SELECT COUNT() AS c FROM myGameData;")[0];
-  auto id = id_obj["c"].toInt();
-  db->exec(sqlAddBlob.arg(id).arg(blob));
-  db->exec(sqlSaveRecord.arg(id).arg(record_blob));
+
+  // 战绩、胜负统计（由trigger维护）和复盘放在同一个事务里；
+  // 录像的编码和写入交给录像日志的写线程，不卡对局结束的那一下
+  // BEGIN 失败（比如等锁超时）的话后面的语句会各自自动提交，所以每一步都要查；
+  // 出错时整局都不存，录像日志留着，下次启动时恢复成录像文件
+  auto fail = [&](const char *what) {
+    qWarning("saveGameData: %s failed, game not saved", what);
+    if (journal) journal->keep();
+  };
+  if (!db->exec("BEGIN IMMEDIATE;")) {
+    fail("BEGIN");
+    return;
+  }
+  if (!db->exec(sqlAddGamaData.arg(time).arg(pid).arg(server_addr).arg(mode)
+      .arg(general).arg(deputy).arg(role).arg(result))) {
+    db->exec("ROLLBACK;");
+    fail("INSERT myGameData");
+    return;
+  }
+
+  auto ret = db->select("SELECT last_insert_rowid() AS c;");
+  auto id = ret.isEmpty() ? 0 : ret[0]["c"].toInt();
+  if (id <= 0 || !db->exec(sqlAddBlob.arg(id).arg(blob)) || !db->exec("COMMIT;")) {
+    db->exec("ROLLBACK;");
+    fail("INSERT myGameRoomData or COMMIT");
+    return;
+  }
+  // 写完后 committed 里再清理旧录像、更新录像库
+  if (journal) journal->commit(id, record);
   // 不emit了 省得天天被问
   // emit toast_message(tr("$AutoSaveRecord"));
 }
+
+QVariantMap Client::getDatabaseReport() const {
+  return maintainer ? maintainer->lastReport() : QVariantMap();
+}
+
+void Client::setRetentionLimits(const QVariantMap &limits) {
+  if (!retention) return;
+  retention->loadLimits(QJsonObject {
+    { "recordingRetention", QJsonObject::fromVariantMap(limits) },
+  });
+  retention->schedule();
+}
@@ -9,11 +9,18 @@ class Lua;
 class Sqlite3;
 class ClientPlayer;
 class Router;
+class RecordingRetention;
+class DbMaintainer;
+class RecordingIndex;
+class RecordingJournal;
+class SpectatorBuffer;
 
 class Client : public QObject {
   Q_OBJECT
 public:
-  Client(QObject *parent = nullptr);
+  // replayOnly 是给 --replay-verify 之类只跑录像的场合用的：数据库换成临时目录里
+  // 新建的一份，不做录像清理、数据库维护、录像索引和录像日志，不碰用户的数据
+  Client(QObject *parent = nullptr, bool replayOnly = false);
   ~Client();
 
   void connectToHost(const QString &server, ushort port, ushort udpPort = 0);
@@ -47,12 +54,31 @@ public:
   Q_INVOKABLE QVariantList execSql(const QString &sql);
   Q_INVOKABLE QString peerAddress();
   Q_INVOKABLE QVariantList getMyGameData();
+  // 分页查询战绩：取 id < beforeId 的至多 limit 条，filter 可含 mode/general/result
+  Q_INVOKABLE QVariantList getMyGameHistory(int beforeId = 0, int limit = 50,
+                                            const QVariantMap &filter = QVariantMap());
+  // 胜负统计：按 mode/general/role 分组（为空则汇总），每行含 key/wins/losses/draws/total
+  Q_INVOKABLE QVariantList getMyGameStats(const QString &groupBy = QString(),
+                                          const QVariantMap &filter = QVariantMap());
+  // 按录像名、评语、玩家、武将、模式检索录像文件与自动保存的录像，多个词之间为“且”
+  // 每行含 source（file/db）、ref（文件名/战绩id）及各检索字段
+  Q_INVOKABLE QVariantList searchRecordings(const QString &query, int limit = 50);
+  // 录像库列表，按开始时间倒序；source 为 file/db 时只列出该来源。每行含 source、ref、
+  // version、name、mode、room_settings/player_info（JSON）、first_ts/last_ts 和 duration（秒）
+  Q_INVOKABLE QVariantList getRecordingLibrary(const QString &source = QString(),
+                                               int limit = 500);
   void saveRecord(const QByteArray &json, const QString &fname);
   void saveGameData(const QString &mode, const QString &general, const QString &deputy,
                     const QString &role, int result, const QString &replay,
                     const QByteArray &room_data, const QByteArray &record);
+  // 调整自动录像的保留上限，键同配置文件 recordingRetention 字段
+  Q_INVOKABLE void setRetentionLimits(const QVariantMap &limits);
+  // 最近一次后台维护的结果：库文件/WAL/空闲页大小等
+  Q_INVOKABLE QVariantMap getDatabaseReport() const;
 
   Router *getRouter() const { return router; }
+  RecordingIndex *getRecordingIndex() const { return recordingIndex; }
+  SpectatorBuffer *getSpectatorBuffer() const { return spectator; }
 signals:
   void notifyUI(const QString &command, const QVariant &jsonData);
   void error_message(const QString &msg);
@@ -77,8 +103,19 @@ private:
   QString crossServerToken;        // 跨服加入的预占位 Token
 
   Lua *L;
+  std::unique_ptr<QTemporaryDir> scratch; // replayOnly 时放数据库
   std::unique_ptr<Sqlite3> db;
+  RecordingRetention *retention = nullptr;
+  DbMaintainer *maintainer = nullptr;
+  RecordingIndex *recordingIndex = nullptr;
+  RecordingJournal *journal = nullptr;
+  SpectatorBuffer *spectator;
   QFileSystemWatcher fsWatcher;
+
+  // 进房间时的房间设置，开始游戏时用来写录像日志的文件头
+  QByteArray roomSettings;
+  // 服务器发来的对局事件同时写进录像日志
+  void journalEvent(const QByteArray &command, const QByteArray &data, bool isRequest);
 };
 
 extern Client *ClientInstance;
@@ -0,0 +1,296 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "client/db_maintainer.h"
+#include "client/blob_codec.h"
+#include "client/replay_format.h"
+#include "core/c-wrapper.h"
+
+DbMaintainer::DbMaintainer(const QString &dbPath, QObject *parent)
+  : QObject(parent), dbPath(dbPath)
+{
+  pool.setMaxThreadCount(1);
+  // 连接在这里就建好，setIdle(false) 要从主线程上 interrupt 它
+  db = std::make_unique<Sqlite3>(dbPath, QString());
+  timer = new QTimer(this);
+  timer->setSingleShot(true);
+  connect(timer, &QTimer::timeout, this, &DbMaintainer::schedule);
+}
+
+DbMaintainer::~DbMaintainer() {
+  if (running) db->interrupt();
+  pool.waitForDone();
+}
+
+void DbMaintainer::setIdle(bool idle) {
+  if (this->idle == idle) return;
+  this->idle = idle;
+
+  if (idle) {
+    timer->start(idleDelay);
+  } else {
+    // 开局了，正在跑的维护立即让路
+    timer->stop();
+    if (running) db->interrupt();
+  }
+}
+
+QVariantMap DbMaintainer::lastReport() const {
+  QMutexLocker locker(&mutex);
+  return report;
+}
+
+void DbMaintainer::schedule() {
+  if (!idle || running.exchange(true))
+    return;
+
+  pool.start([this]() {
+    run();
+    running = false;
+    // 回到所属线程安排下一次
+    QMetaObject::invokeMethod(this, [this]() {
+      if (idle) timer->start(backlog ? idleDelay : interval);
+    }, Qt::QueuedConnection);
+  });
+}
+
+qint64 DbMaintainer::pragmaValue(const QString &pragma) {
+  auto ret = db->select(QString("PRAGMA %1;").arg(pragma));
+  return ret.isEmpty() ? 0 : ret[0].first().toLongLong();
+}
+
+qint64 DbMaintainer::metaValue(const QString &key) {
+  auto ret = db->select(QString("SELECT value FROM clientMeta WHERE key = '%1';").arg(key));
+  return ret.isEmpty() ? 0 : ret[0]["value"].toLongLong();
+}
+
+bool DbMaintainer::setMetaValue(const QString &key, qint64 value) {
+  return db->exec(QString("INSERT INTO clientMeta (key, value) VALUES ('%1', %2) "
+                          "ON CONFLICT(key) DO UPDATE SET value = excluded.value;").arg(key).arg(value));
+}
+
+QByteArray DbMaintainer::dictionary(Sqlite3 &db, qint64 id) {
+  static QMutex cacheLock;
+  static QHash<qint64, QByteArray> cache;
+  if (id < 0) return QByteArray();
+  {
+    QMutexLocker locker(&cacheLock);
+    if (cache.contains(id)) return cache[id];
+  }
+
+  auto ret = db.select(QString("SELECT hex(data) AS d FROM blobDictionary WHERE id = %1;").arg(id));
+  if (ret.isEmpty()) return QByteArray();
+  auto dict = QByteArray::fromHex(ret[0]["d"].toLatin1());
+  QMutexLocker locker(&cacheLock);
+  cache[id] = dict;
+  return dict;
+}
+
+QByteArray DbMaintainer::unpackRoomData(Sqlite3 &db, const QByteArray &raw) {
+  return BlobCodec::decompress(raw, dictionary(db, BlobCodec::dictId(raw)));
+}
+
+qint64 DbMaintainer::roomDictionary() {
+  auto ret = db->select("SELECT id FROM blobDictionary WHERE kind = 'room_data' "
+                        "ORDER BY id DESC LIMIT 1;");
+  if (!ret.isEmpty()) return ret[0]["id"].toLongLong();
+
+  // 用最近的复盘资料训练；样本太少的话先不做
+  auto rows = db->select(QString("SELECT hex(room_data) AS r FROM myGameRoomData "
+                                 "ORDER BY id DESC LIMIT %1;").arg(dictSamples));
+  if (rows.size() < dictSamples) return -1;
+  QList<QByteArray> samples;
+  for (auto &row : rows) {
+    auto raw = QByteArray::fromHex(row["r"].toLatin1());
+    if (!BlobCodec::isDict(raw)) samples << qUncompress(raw);
+  }
+  auto dict = BlobCodec::train(samples);
+  if (dict.isEmpty()) return -1;
+
+  if (!db->exec(QString("INSERT INTO blobDictionary (kind, data, created) "
+                        "VALUES ('room_data', x'%1', %2);")
+                .arg(dict.toHex()).arg(QDateTime::currentSecsSinceEpoch())))
+    return -1;
+  ret = db->select("SELECT last_insert_rowid() AS id;");
+  qInfo("client.db: trained room data dictionary, %lld bytes", (qint64)dict.size());
+  return ret.isEmpty() ? -1 : ret[0]["id"].toLongLong();
+}
+
+bool DbMaintainer::recompress(const QDeadlineTimer &deadline, int &rows, qint64 &saved) {
+  auto dictId = roomDictionary();
+  auto dict = dictionary(*db, dictId);
+
+  struct Job {
+    QString table;
+    QString column;
+    QString key;
+    std::function<QByteArray(const QByteArray &)> pack; // 返回空表示不用改
+  };
+  QList<Job> jobs {
+    { "myGameRecordings", "recording", "archive.recording_watermark",
+      [](const QByteArray &raw) {
+        if (ReplayFormat::isV2(raw)) return QByteArray();
+        // encode() 核对过能原样解回来才会给出 v2
+        auto v2 = ReplayFormat::encode(qUncompress(raw));
+        return ReplayFormat::isV2(v2) ? v2 : QByteArray();
+      } },
+  };
+  if (dictId >= 0) {
+    jobs << Job { "myGameRoomData", "room_data", "archive.room_data_watermark",
+      [&](const QByteArray &raw) {
+        if (BlobCodec::isDict(raw)) return QByteArray();
+        auto data = qUncompress(raw);
+        if (data.isEmpty()) return QByteArray();
+        auto packed = BlobCodec::compress(data, dict, dictId);
+        if (BlobCodec::decompress(packed, dict) != data) return QByteArray();
+        return packed;
+      } };
+  }
+
+  for (auto &job : jobs) {
+    auto watermark = metaValue(job.key);
+    forever {
+      if (deadline.hasExpired() || !idle) return true;
+      auto batch = db->select(QString("SELECT id, hex(%1) AS b FROM %2 WHERE id > %3 "
+                                      "ORDER BY id LIMIT %4;")
+                              .arg(job.column, job.table).arg(watermark).arg(recompressBatch));
+      if (batch.isEmpty()) break;
+
+      int n = 0;
+      qint64 bytes = 0;
+      qint64 next = watermark;
+      // setIdle(false) 打断事务里的语句时 sqlite 会把整个事务回滚掉，
+      // 之后的语句就成了自动提交；所以任何一条失败都立即停下，整批下次重来
+      bool ok = db->exec("BEGIN;");
+      for (auto &row : batch) {
+        if (!ok || deadline.hasExpired() || !idle) break;
+        auto raw = QByteArray::fromHex(row["b"].toLatin1());
+        auto packed = job.pack(raw);
+        if (!packed.isEmpty() && packed.size() < raw.size()) {
+          ok = db->exec(QString("UPDATE %1 SET %2 = x'%3' WHERE id = %4;")
+                        .arg(job.table, job.column, packed.toHex(), row["id"]));
+          if (!ok) break;
+          n++;
+          bytes += raw.size() - packed.size();
+        }
+        next = row["id"].toLongLong();
+      }
+      // 水位线和这一批的改动在同一个事务里，只有 COMMIT 成功才算数
+      if (ok && next != watermark) ok = setMetaValue(job.key, next);
+      if (!ok || !idle || !db->exec("COMMIT;")) {
+        db->exec("ROLLBACK;");
+        return true;
+      }
+      watermark = next;
+      rows += n;
+      saved += bytes;
+    }
+  }
+  return false;
+}
+
+bool DbMaintainer::quickCheck(qint64 now, QString &result) {
+  auto next = metaValue("maintenance.quick_check_next");
+  if (next == 0 && now - metaValue("maintenance.quick_check") <= checkInterval) return false;
+
+  auto tables = db->select("SELECT name FROM sqlite_master WHERE type = 'table' ORDER BY name;");
+  auto attempts = metaValue("maintenance.quick_check_attempts");
+  auto errors = next == 0 ? 0 : metaValue("maintenance.quick_check_errors");
+  setMetaValue("maintenance.quick_check_attempted", now);
+
+  // 一张表在预算内查不完的话，下次给它加倍的时间
+  db->setDeadline(QDeadlineTimer(checkBudget << qMin<qint64>(attempts, 6)));
+  auto start = next;
+  for (; next < tables.size() && idle; next++) {
+    auto ret = db->select(QString("PRAGMA quick_check('%1');").arg(tables[next]["name"]));
+    if (ret.isEmpty()) break; // 被打断了
+    for (auto &row : ret) {
+      auto msg = row.first();
+      if (msg == "ok") continue;
+      qWarning() << "client.db quick_check failed:" << msg;
+      if (result.isEmpty()) result = msg;
+      errors++;
+    }
+  }
+  db->setDeadline(QDeadlineTimer(QDeadlineTimer::Forever));
+
+  if (next < tables.size()) {
+    // 下次从没查完的那张表接着来
+    setMetaValue("maintenance.quick_check_next", next);
+    setMetaValue("maintenance.quick_check_errors", errors);
+    setMetaValue("maintenance.quick_check_attempts", next == start ? attempts + 1 : 1);
+    return true;
+  }
+  setMetaValue("maintenance.quick_check", now);
+  setMetaValue("maintenance.quick_check_next", 0);
+  setMetaValue("maintenance.quick_check_errors", 0);
+  setMetaValue("maintenance.quick_check_attempts", 0);
+  if (errors == 0) result = "ok";
+  else if (result.isEmpty()) result = QString("%1 errors").arg(errors);
+  return false;
+}
+
+void DbMaintainer::run() {
+  QElapsedTimer elapsed;
+  elapsed.start();
+  QDeadlineTimer deadline(budget);
+  db->setDeadline(deadline);
+
+  // 1. checkpoint：PASSIVE 不会等待其他连接上的读写
+  db->select("PRAGMA wal_checkpoint(PASSIVE);");
+
+  // 2. 分块回收空闲页
+  qint64 freed = 0;
+  while (!deadline.hasExpired() && idle) {
+    auto freePages = pragmaValue("freelist_count");
+    if (freePages <= 0) break;
+    if (!db->exec(QString("PRAGMA incremental_vacuum(%1);").arg(vacuumStep)))
+      break;
+    freed += qMin<qint64>(freePages, vacuumStep);
+  }
+
+  // 3. 统计信息
+  if (!deadline.hasExpired() && idle) {
+    db->exec("PRAGMA optimize;");
+  }
+
+  // 4. 完整性检查，隔一段时间才做一次，按表分步做，预算另算
+  auto now = QDateTime::currentSecsSinceEpoch();
+  QString checkResult;
+  bool checkPending = idle && quickCheck(now, checkResult);
+
+  // 5. 重新压缩旧数据，预算另算；语句不按期限打断，免得 COMMIT 被打断
+  db->setDeadline(QDeadlineTimer(QDeadlineTimer::Forever));
+  int recompressed = 0;
+  qint64 saved = 0;
+  backlog = checkPending;
+  if (idle && recompress(QDeadlineTimer(recompressBudget), recompressed, saved)) {
+    backlog = true;
+  }
+
+  // 6. 大小统计不受预算限制，都是读文件头的小查询
+  auto pageSize = pragmaValue("page_size");
+  QVariantMap r;
+  r["fileSize"] = QFileInfo(dbPath).size();
+  r["walSize"] = QFileInfo(dbPath + "-wal").size();
+  r["usedSize"] = (pragmaValue("page_count") - pragmaValue("freelist_count")) * pageSize;
+  r["freeSize"] = pragmaValue("freelist_count") * pageSize;
+  r["freedSize"] = freed * pageSize;
+  r["recompressedRows"] = recompressed;
+  r["recompressedSaved"] = saved;
+  r["elapsed"] = elapsed.elapsed();
+  r["timestamp"] = now;
+  if (!checkResult.isEmpty()) r["quickCheck"] = checkResult;
+  r["quickCheckPending"] = checkPending;
+  r["quickCheckAttempted"] = metaValue("maintenance.quick_check_attempted");
+  r["quickCheckCompleted"] = metaValue("maintenance.quick_check");
+
+  {
+    QMutexLocker locker(&mutex);
+    report = r;
+  }
+  qInfo("client.db maintenance: %lld ms, freed %lld bytes, recompressed %d rows (-%lld bytes), "
+        "file %lld bytes, wal %lld bytes",
+        r["elapsed"].toLongLong(), r["freedSize"].toLongLong(), recompressed, saved,
+        r["fileSize"].toLongLong(), r["walSize"].toLongLong());
+  emit reported(r);
+}
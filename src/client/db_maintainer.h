@@ -0,0 +1,82 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _DB_MAINTAINER_H
+#define _DB_MAINTAINER_H
+
+class Sqlite3;
+
+/**
+  client.db 的后台维护。
+
+  只在空闲（大厅中，不在对局/录像里）时工作，并且每次运行都有时间预算，
+  超时的语句会被直接打断，下次空闲时再继续。每次运行依次做：
+
+  - wal_checkpoint(PASSIVE)：把 WAL 写回主库，不等待读者
+  - incremental_vacuum：按块回收空闲页，直到没有空闲页或预算用完
+  - PRAGMA optimize：让 sqlite 自己决定要不要 ANALYZE
+  - quick_check：每隔 checkInterval 做一次，逐表检查（单独的预算 checkBudget），
+    查到哪张表、尝试和完成的时间都记在 clientMeta 里，做不完下次空闲时接着做；
+    同一张表一直查不完的话每次把预算加倍
+  - 重新压缩旧数据（单独的预算 recompressBudget）：myGameRecordings 中的 v1
+    录像转成 v2，myGameRoomData 换成共享字典压缩（见 blob_codec.h），字典从
+    最近的复盘资料里训练一次。每张表在 clientMeta 里记水位线，每个事务只改
+    recompressBatch 行；还没做完的话下次空闲时尽快接着做
+  - 统计库文件、WAL、空闲页大小，通过 reported 发出
+
+  所有操作都在单独的工作线程和单独的连接上进行。
+  */
+class DbMaintainer : public QObject {
+  Q_OBJECT
+
+public:
+  DbMaintainer(const QString &dbPath, QObject *parent = nullptr);
+  ~DbMaintainer();
+
+  // 进入大厅时置 true，进入房间时置 false；只能在所属线程调用
+  void setIdle(bool idle);
+  bool isIdle() const { return idle; }
+
+  QVariantMap lastReport() const;
+
+  int budget = 200;                      // 每次运行的时间预算，毫秒
+  int idleDelay = 10 * 1000;             // 进入空闲多久之后开始第一次维护
+  int interval = 10 * 60 * 1000;         // 持续空闲时的维护间隔
+  qint64 checkInterval = 7 * 24 * 3600;  // quick_check 间隔，秒
+  int checkBudget = 1000;                // 每次运行 quick_check 的时间预算，毫秒
+  int vacuumStep = 64;                   // 每条 incremental_vacuum 回收的页数
+  int recompressBudget = 2000;           // 每次运行重新压缩旧数据的时间预算，毫秒
+  int recompressBatch = 20;              // 重新压缩时每个事务改多少行
+  int dictSamples = 64;                  // 训练字典用多少份复盘资料
+
+  // blobDictionary 中的字典，解出来的会缓存；可以在任意线程调用
+  static QByteArray dictionary(Sqlite3 &db, qint64 id);
+  // 解压 myGameRoomData 中的数据，旧的 qCompress 和字典压缩的都行
+  static QByteArray unpackRoomData(Sqlite3 &db, const QByteArray &raw);
+
+signals:
+  void reported(const QVariantMap &report);
+
+private:
+  QString dbPath;
+  std::unique_ptr<Sqlite3> db; // 除 interrupt() 外只在工作线程中使用
+  QThreadPool pool;
+  QTimer *timer;
+  std::atomic_bool idle = false; // 工作线程里也会读
+  std::atomic_bool running = false;
+  std::atomic_bool backlog = false;
+  mutable QMutex mutex;
+  QVariantMap report;
+
+  void schedule();
+  void run();
+  qint64 pragmaValue(const QString &pragma);
+  qint64 metaValue(const QString &key);
+  bool setMetaValue(const QString &key, qint64 value);
+  qint64 roomDictionary();
+  // 还没查完时返回 true；查完一轮时 result 是 "ok" 或者第一条错误
+  bool quickCheck(qint64 now, QString &result);
+  // 还有没处理完的行时返回 true
+  bool recompress(const QDeadlineTimer &deadline, int &rows, qint64 &saved);
+};
+
+#endif // _DB_MAINTAINER_H
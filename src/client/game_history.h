@@ -0,0 +1,96 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+// 战绩查询：按 id 倒序的游标分页（keyset pagination）
+// 配合 init.sql 中的 myGameData_owner 索引，翻到第几页都只扫描 limit 行
+// 胜率统计则读 myGameStats 聚合表，代价只和分组数有关
+
+#ifndef GAME_HISTORY_H
+#define GAME_HISTORY_H
+
+#include <QString>
+#include <QVariantMap>
+
+struct GameHistoryQuery {
+  int pid = 0;
+  QString serverAddr;
+  qint64 beforeId = 0;  // 只取 id < beforeId 的记录；<= 0 表示从最新一局开始
+  int limit = 50;
+  QString mode;         // 为空表示不过滤
+  QString general;      // 主将或副将为该武将
+  int result = 0;       // 1=胜 2=负 3=平，0 表示不过滤
+};
+
+// 单页最多取这么多条，防止 QML 一口气把整张表拉走
+static constexpr int GameHistoryMaxLimit = 500;
+
+// SQL 字符串字面量转义：单引号双写
+inline QString gameHistoryQuote(const QString &s) {
+  QString ret = s;
+  ret.replace('\'', "''");
+  return '\'' + ret + '\'';
+}
+
+inline GameHistoryQuery gameHistoryQueryFromVariant(const QVariantMap &filter) {
+  GameHistoryQuery q;
+  q.mode = filter.value("mode").toString();
+  q.general = filter.value("general").toString();
+  q.result = filter.value("result").toInt();
+  return q;
+}
+
+inline QString buildGameHistoryQuery(const GameHistoryQuery &q) {
+  int limit = qBound(1, q.limit, GameHistoryMaxLimit);
+
+  QString sql = QStringLiteral("SELECT * FROM myGameData WHERE pid = %1 AND server_addr = %2")
+    .arg(q.pid).arg(gameHistoryQuote(q.serverAddr));
+  if (q.beforeId > 0)
+    sql += QStringLiteral(" AND id < %1").arg(q.beforeId);
+  if (!q.mode.isEmpty())
+    sql += QStringLiteral(" AND mode = %1").arg(gameHistoryQuote(q.mode));
+  if (!q.general.isEmpty())
+    sql += QStringLiteral(" AND (general = %1 OR deputy_general = %1)")
+      .arg(gameHistoryQuote(q.general));
+  if (q.result > 0)
+    sql += QStringLiteral(" AND result = %1").arg(q.result);
+  sql += QStringLiteral(" ORDER BY id DESC LIMIT %1;").arg(limit);
+  return sql;
+}
+
+struct GameStatsQuery {
+  int pid = 0;
+  QString serverAddr;
+  QString groupBy;      // mode/general/role 之一，为空时汇总成一行
+  QString mode;         // 以下为过滤条件，为空表示不过滤
+  QString general;
+  QString role;
+};
+
+inline GameStatsQuery gameStatsQueryFromVariant(const QString &groupBy,
+                                                const QVariantMap &filter) {
+  GameStatsQuery q;
+  static const QStringList columns = { "mode", "general", "role" };
+  q.groupBy = columns.contains(groupBy) ? groupBy : QString();
+  q.mode = filter.value("mode").toString();
+  q.general = filter.value("general").toString();
+  q.role = filter.value("role").toString();
+  return q;
+}
+
+inline QString buildGameStatsQuery(const GameStatsQuery &q) {
+  QString key = q.groupBy.isEmpty() ? QStringLiteral("''") : q.groupBy;
+  QString sql = QStringLiteral("SELECT %1 AS key, SUM(wins) AS wins, SUM(losses) AS losses, "
+                               "SUM(draws) AS draws, SUM(wins + losses + draws) AS total "
+                               "FROM myGameStats WHERE pid = %2 AND server_addr = %3")
+    .arg(key).arg(q.pid).arg(gameHistoryQuote(q.serverAddr));
+  if (!q.mode.isEmpty())
+    sql += QStringLiteral(" AND mode = %1").arg(gameHistoryQuote(q.mode));
+  if (!q.general.isEmpty())
+    sql += QStringLiteral(" AND general = %1").arg(gameHistoryQuote(q.general));
+  if (!q.role.isEmpty())
+    sql += QStringLiteral(" AND role = %1").arg(gameHistoryQuote(q.role));
+  if (!q.groupBy.isEmpty())
+    sql += QStringLiteral(" GROUP BY %1 ORDER BY total DESC").arg(q.groupBy);
+  sql += ';';
+  return sql;
+}
+
+#endif // GAME_HISTORY_H
@@ -0,0 +1,382 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "client/recording_index.h"
+#include "client/recording_meta.h"
+#include "client/replay_reader.h"
+#include "core/c-wrapper.h"
+
+#include <QtConcurrent>
+
+static QString sqlQuote(const QString &s) {
+  return "'" + QString(s).replace('\'', "''") + "'";
+}
+
+// 房间设置/玩家信息可能是CBOR也可能是JSON，统一存成JSON给界面用
+static QString toJsonText(const QByteArray &data) {
+  QCborParserError err;
+  auto v = QCborValue::fromCbor(data, &err);
+  if (err.error == QCborError::NoError && (v.isMap() || v.isArray())) {
+    return QJsonDocument::fromVariant(v.toVariant()).toJson(QJsonDocument::Compact);
+  }
+  auto doc = QJsonDocument::fromJson(data);
+  return doc.isNull() ? QString() : doc.toJson(QJsonDocument::Compact);
+}
+
+// 每批从数据库补录多少条录像，避免长时间占着写锁
+static constexpr int ReconcileBatch = 100;
+// 录像文件每解析多少个写一次库
+static constexpr int ScanSlice = 200;
+
+struct RecordingIndex::Entry {
+  QString source;
+  QString ref;
+  qint64 mtime = 0;
+  qint64 size = 0;
+  bool valid = false;
+  QString version;
+  QString name;
+  QString mode;
+  QString roomSettings;
+  QString playerInfo;
+  qint64 first = 0;
+  qint64 last = 0;
+  QStringList players;
+  QStringList generals;
+};
+
+RecordingIndex::RecordingIndex(const QString &dbPath, const QString &recordingDir,
+                               QObject *parent)
+  : QObject(parent), dbPath(dbPath), recordingDir(recordingDir)
+{
+  pool.setMaxThreadCount(1);
+  db = std::make_unique<Sqlite3>(dbPath, QString());
+  type = ensureSchema();
+}
+
+RecordingIndex::~RecordingIndex() {
+  wait();
+}
+
+void RecordingIndex::wait() {
+  pool.waitForDone();
+}
+
+RecordingIndex::Backend RecordingIndex::ensureSchema() {
+  static auto columns = QStringLiteral("name, comment, players, generals, mode, "
+                                       "source UNINDEXED, ref UNINDEXED");
+
+  // FTS5 和 trigram 分词器（sqlite 3.34+）在各平台自带的 sqlite 里不一定有
+  auto sql = db->select("SELECT sql FROM sqlite_master WHERE name = 'recordingSearch';");
+  if (sql.isEmpty()) {
+    if (!db->exec(QString("CREATE VIRTUAL TABLE recordingSearch USING fts5(%1, "
+                          "tokenize = 'trigram');").arg(columns)) &&
+        !db->exec(QString("CREATE VIRTUAL TABLE recordingSearch USING fts5(%1);")
+                  .arg(columns))) {
+      db->exec("CREATE TABLE recordingSearch (name TEXT, comment TEXT, players TEXT, "
+               "generals TEXT, mode TEXT, source TEXT, ref TEXT);");
+      db->exec("CREATE INDEX IF NOT EXISTS recordingSearch_ref ON recordingSearch (source, ref);");
+    }
+    sql = db->select("SELECT sql FROM sqlite_master WHERE name = 'recordingSearch';");
+  }
+
+  // 收藏评语随 starredRecording 同步
+  db->exec(R"(
+CREATE TRIGGER IF NOT EXISTS searchStarInsert AFTER INSERT ON starredRecording
+BEGIN
+  UPDATE recordingSearch SET comment = new.my_comment
+    WHERE (source = 'file' AND ref IN (new.replay_name, new.replay_name || '.fk.rep'))
+       OR (source = 'db' AND ref = CAST(new.id AS TEXT));
+END;
+)");
+  db->exec(R"(
+CREATE TRIGGER IF NOT EXISTS searchStarUpdate AFTER UPDATE OF my_comment ON starredRecording
+BEGIN
+  UPDATE recordingSearch SET comment = new.my_comment
+    WHERE (source = 'file' AND ref IN (new.replay_name, new.replay_name || '.fk.rep'))
+       OR (source = 'db' AND ref = CAST(new.id AS TEXT));
+END;
+)");
+  db->exec(R"(
+CREATE TRIGGER IF NOT EXISTS searchStarDelete AFTER DELETE ON starredRecording
+BEGIN
+  UPDATE recordingSearch SET comment = ''
+    WHERE (source = 'file' AND ref IN (old.replay_name, old.replay_name || '.fk.rep'))
+       OR (source = 'db' AND ref = CAST(old.id AS TEXT));
+END;
+)");
+
+  auto def = sql.isEmpty() ? QString() : sql[0]["sql"];
+  if (!def.contains("fts5", Qt::CaseInsensitive)) {
+    qInfo("recording search: FTS5 unavailable, falling back to LIKE");
+    return Plain;
+  }
+  return def.contains("trigram", Qt::CaseInsensitive) ? FtsTrigram : Fts;
+}
+
+RecordingIndex::Entry RecordingIndex::scan(const QString &source, const QString &ref,
+                                           const QByteArray &raw) {
+  Entry e;
+  e.source = source;
+  e.ref = ref;
+  e.size = raw.size();
+
+  ReplayReader reader;
+  if (!reader.open(raw)) return e;
+  e.valid = true;
+  e.version = reader.version;
+  e.name = reader.fileName;
+  e.mode = RecordingMeta::modeFromRoomSettings(reader.roomSettings);
+  e.roomSettings = toJsonText(reader.roomSettings);
+  e.playerInfo = toJsonText(reader.playerInfo);
+
+  // 检索要的玩家和武将得看全部事件，所以整个录像还是要解压一遍（v1 一次
+  // 解压完，v2 逐块解压、读过的块就丢掉），但不再转回 v1 CBOR、建整棵
+  // QCborValue 树；事件流式读出，只解析 AddPlayer/PropertyUpdate 的参数
+  RecordingMeta meta;
+  meta.playerInfo = reader.playerInfo;
+  ReplayReader::Event ev;
+  while (reader.next(ev)) meta.addEvent(ev.elapsed, ev.cmd, ev.data);
+  meta.finishEvents();
+  e.first = meta.firstTimestamp;
+  e.last = meta.lastTimestamp;
+  e.players = meta.players;
+  e.generals = meta.generals;
+  return e;
+}
+
+RecordingIndex::Entry RecordingIndex::scanFile(const QFileInfo &info) {
+  Entry e;
+  QFile file(info.absoluteFilePath());
+  if (file.open(QIODevice::ReadOnly)) {
+    e = scan("file", info.fileName(), file.readAll());
+  }
+  // 解析失败的也记下 mtime/size，文件不变就不再重试
+  e.source = "file";
+  e.ref = info.fileName();
+  e.mtime = info.lastModified().toMSecsSinceEpoch();
+  e.size = info.size();
+  return e;
+}
+
+void RecordingIndex::write(const Entry &e) {
+  db->exec(QString("INSERT INTO recordingLibrary (source, ref, mtime, size, version, name, "
+                   "mode, room_settings, player_info, first_ts, last_ts) "
+                   "VALUES ('%5', %6, %1, %2, %7, %8, %9, %10, %11, %3, %4) "
+                   "ON CONFLICT(source, ref) DO UPDATE SET mtime = excluded.mtime, "
+                   "size = excluded.size, version = excluded.version, name = excluded.name, "
+                   "mode = excluded.mode, room_settings = excluded.room_settings, "
+                   "player_info = excluded.player_info, first_ts = excluded.first_ts, "
+                   "last_ts = excluded.last_ts;")
+           // 数字先填，字符串里的 % 不会再被当成占位符
+           .arg(e.mtime).arg(e.size).arg(e.first).arg(e.last)
+           .arg(e.source, sqlQuote(e.ref), sqlQuote(e.version), sqlQuote(e.name),
+                sqlQuote(e.mode), sqlQuote(e.roomSettings), sqlQuote(e.playerInfo)));
+
+  if (!e.valid) {
+    db->exec(QString("DELETE FROM recordingSearch WHERE source = '%1' AND ref = %2;")
+             .arg(e.source, sqlQuote(e.ref)));
+    return;
+  }
+  auto name = e.name.isEmpty() && e.source == "file" ? e.ref : e.name;
+  insertRow(e.source, e.ref, name, e.players, e.generals, e.mode);
+}
+
+void RecordingIndex::insertRow(const QString &source, const QString &ref, const QString &name,
+                               const QStringList &players, const QStringList &generals,
+                               const QString &mode) {
+  auto where = QString("source = '%1' AND ref = %2").arg(source, sqlQuote(ref));
+  // 评语可能在录像进索引之前就有了
+  auto comment = source == "file" ?
+    QString("SELECT my_comment FROM starredRecording WHERE replay_name IN (%1, %2)")
+      .arg(sqlQuote(ref), sqlQuote(QString(ref).remove(QRegularExpression("\\.fk\\.rep$")))) :
+    QString("SELECT my_comment FROM starredRecording WHERE id = %1").arg(ref.toInt());
+
+  db->exec(QString("DELETE FROM recordingSearch WHERE %1;").arg(where));
+  db->exec(QString("INSERT INTO recordingSearch "
+                   "(name, comment, players, generals, mode, source, ref) "
+                   "VALUES (%1, coalesce((%2), ''), %3, %4, %5, '%6', %7);")
+           .arg(sqlQuote(name), comment, sqlQuote(players.join(' ')),
+                sqlQuote(generals.join(' ')), sqlQuote(mode), source, sqlQuote(ref)));
+}
+
+void RecordingIndex::addFile(const QString &fileName) {
+  pool.start([=, this]() {
+    auto e = scanFile(QFileInfo(QDir(recordingDir).filePath(fileName)));
+    db->exec("BEGIN;");
+    write(e);
+    db->exec("COMMIT;");
+  });
+}
+
+void RecordingIndex::addGame(int id, const QString &mode, const QString &general,
+                             const QString &deputy, const QByteArray &raw) {
+  pool.start([=, this]() {
+    auto e = scan("db", QString::number(id), raw);
+    for (auto g : { general, deputy }) {
+      if (!g.isEmpty() && !e.generals.contains(g)) e.generals.prepend(g);
+    }
+    if (!mode.isEmpty()) e.mode = mode;
+    db->exec("BEGIN;");
+    write(e);
+    db->exec("COMMIT;");
+  });
+}
+
+void RecordingIndex::removeFile(const QString &fileName) {
+  pool.start([=, this]() {
+    auto where = QString("source = 'file' AND ref = %1").arg(sqlQuote(fileName));
+    db->exec("BEGIN;");
+    db->exec(QString("DELETE FROM recordingLibrary WHERE %1;").arg(where));
+    db->exec(QString("DELETE FROM recordingSearch WHERE %1;").arg(where));
+    db->exec("COMMIT;");
+  });
+}
+
+void RecordingIndex::purgeGames() {
+  pool.start([this]() { purgeDeletedGames(); });
+}
+
+void RecordingIndex::purgeDeletedGames() {
+  // 收藏的对局不会被清理，所以不能按最小 id 一刀切，要逐条看录像还在不在
+  db->exec("BEGIN;");
+  for (auto table : { "recordingLibrary", "recordingSearch" }) {
+    db->exec(QString("DELETE FROM %1 WHERE source = 'db' AND NOT EXISTS "
+                     "(SELECT 1 FROM myGameRecordings WHERE id = CAST(ref AS INTEGER));")
+             .arg(table));
+  }
+  db->exec("COMMIT;");
+}
+
+void RecordingIndex::reconcile() {
+  pool.start([this]() {
+    reconcileFiles();
+    reconcileGames();
+  });
+}
+
+void RecordingIndex::reconcileFiles() {
+  QHash<QString, QPair<qint64, qint64>> known;
+  for (auto row : db->select("SELECT ref, mtime, size FROM recordingLibrary "
+                             "WHERE source = 'file';")) {
+    known[row["ref"]] = { row["mtime"].toLongLong(), row["size"].toLongLong() };
+  }
+
+  QList<QFileInfo> changed;
+  QDir dir(recordingDir);
+  for (auto &info : dir.entryInfoList({ "*.fk.rep" }, QDir::Files)) {
+    auto it = known.find(info.fileName());
+    if (it != known.end()) {
+      auto same = it->first == info.lastModified().toMSecsSinceEpoch() &&
+        it->second == info.size();
+      known.erase(it);
+      if (same) continue;
+    }
+    changed << info;
+  }
+
+  // 解压和解析在全局线程池里并行，写库仍在这个线程上按批提交
+  for (qsizetype i = 0; i < changed.size(); i += ScanSlice) {
+    auto entries = QtConcurrent::blockingMapped<QList<Entry>>(
+      changed.mid(i, ScanSlice), &RecordingIndex::scanFile);
+    db->exec("BEGIN;");
+    for (auto &e : entries) write(e);
+    db->exec("COMMIT;");
+  }
+
+  // 剩下的是文件已经被删掉的
+  db->exec("BEGIN;");
+  for (auto it = known.cbegin(); it != known.cend(); it++) {
+    db->exec(QString("DELETE FROM recordingLibrary WHERE source = 'file' AND ref = %1;")
+             .arg(sqlQuote(it.key())));
+  }
+  // 旧版本只有检索表
+  db->exec("DELETE FROM recordingSearch WHERE source = 'file' AND ref NOT IN "
+           "(SELECT ref FROM recordingLibrary WHERE source = 'file');");
+  db->exec("COMMIT;");
+}
+
+void RecordingIndex::reconcileGames() {
+  auto ret = db->select("SELECT value FROM clientMeta WHERE key = 'library.db_watermark';");
+  qint64 watermark = ret.isEmpty() ? 0 : ret[0]["value"].toLongLong();
+
+  purgeDeletedGames();
+
+  forever {
+    auto rows = db->select(QString(
+      "SELECT r.id AS id, hex(r.recording) AS recording, d.mode AS mode, "
+      "d.general AS general, d.deputy_general AS deputy "
+      "FROM myGameRecordings r LEFT JOIN myGameData d ON d.id = r.id "
+      "WHERE r.id > %1 ORDER BY r.id LIMIT %2;").arg(watermark).arg(ReconcileBatch));
+    if (rows.isEmpty()) break;
+
+    auto entries = QtConcurrent::blockingMapped<QList<Entry>>(rows,
+      [](const QMap<QString, QString> &row) {
+        auto e = scan("db", row["id"], QByteArray::fromHex(row["recording"].toLatin1()));
+        for (auto g : { row["general"], row["deputy"] }) {
+          if (!g.isEmpty() && !e.generals.contains(g)) e.generals.prepend(g);
+        }
+        if (!row["mode"].isEmpty()) e.mode = row["mode"];
+        return e;
+      });
+    watermark = rows.last()["id"].toLongLong();
+
+    db->exec("BEGIN;");
+    for (auto &e : entries) write(e);
+    db->exec(QString("INSERT INTO clientMeta (key, value) VALUES ('library.db_watermark', %1) "
+                     "ON CONFLICT(key) DO UPDATE SET value = excluded.value;").arg(watermark));
+    db->exec("COMMIT;");
+  }
+}
+
+QString RecordingIndex::buildLibraryQuery(const QString &source, int limit) {
+  limit = qBound(1, limit, 5000);
+  auto where = QStringLiteral("version <> ''");
+  if (source == "file" || source == "db") {
+    where += QString(" AND source = '%1'").arg(source);
+  }
+  return QString("SELECT source, ref, version, name, mode, room_settings, player_info, "
+                 "first_ts, last_ts, (last_ts - first_ts) / 1000 AS duration "
+                 "FROM recordingLibrary WHERE %1 ORDER BY first_ts DESC LIMIT %2;")
+    .arg(where).arg(limit);
+}
+
+QString RecordingIndex::buildSearchQuery(const QString &query, int limit, Backend backend) {
+  static auto columns = QStringLiteral("source, ref, name, comment, players, generals, mode");
+  limit = qBound(1, limit, 500);
+  auto tokens = query.split(QRegularExpression("\\s+"), Qt::SkipEmptyParts);
+  if (tokens.isEmpty()) {
+    return QString("SELECT %1 FROM recordingSearch ORDER BY rowid DESC LIMIT %2;")
+      .arg(columns).arg(limit);
+  }
+
+  // trigram 分词查不了少于3个字的词（比如两个字的武将名），这时只能走 LIKE
+  bool useMatch = backend == Fts;
+  if (backend == FtsTrigram) {
+    useMatch = std::all_of(tokens.cbegin(), tokens.cend(),
+                           [](const QString &t) { return t.length() >= 3; });
+  }
+
+  if (useMatch) {
+    QStringList terms;
+    for (auto &t : tokens) {
+      terms << "\"" + QString(t).replace('"', "\"\"") + "\"";
+    }
+    // 录像名和评语的权重高于玩家/武将，模式最低
+    return QString("SELECT %1 FROM recordingSearch WHERE recordingSearch MATCH %2 "
+                   "ORDER BY bm25(recordingSearch, 10.0, 5.0, 3.0, 3.0, 1.0) LIMIT %3;")
+      .arg(columns, sqlQuote(terms.join(' '))).arg(limit);
+  }
+
+  QStringList conds;
+  for (auto t : tokens) {
+    t.replace('\\', "\\\\").replace('%', "\\%").replace('_', "\\_");
+    auto pattern = sqlQuote("%" + t + "%");
+    QStringList likes;
+    for (auto col : { "name", "comment", "players", "generals", "mode" }) {
+      likes << QString("%1 LIKE %2 ESCAPE '\\'").arg(col, pattern);
+    }
+    conds << "(" + likes.join(" OR ") + ")";
+  }
+  return QString("SELECT %1 FROM recordingSearch WHERE %2 ORDER BY rowid DESC LIMIT %3;")
+    .arg(columns, conds.join(" AND ")).arg(limit);
+}
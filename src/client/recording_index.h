@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _RECORDING_INDEX_H
+#define _RECORDING_INDEX_H
+
+class Sqlite3;
+
+/**
+  录像库与录像检索索引。
+
+  覆盖 recording/ 下的录像文件（source = 'file', ref = 文件名）以及数据库中
+  自动保存的录像（source = 'db', ref = gameData id），维护两张表：
+
+  - recordingLibrary：文件头信息（版本、录像名、房间设置、玩家信息、首末时间戳），
+    录像列表直接读这里，不用逐个打开录像。文件按 mtime/size 判断是否要重新解析
+  - recordingSearch：可按录像名、收藏评语、玩家名、武将、模式检索。优先使用 FTS5
+    的 trigram 分词（中文名也能按子串查），sqlite 不支持时依次退化为普通 FTS5、
+    普通表 + LIKE。收藏评语由 starredRecording 上的 trigger 同步
+
+  写入都在后台线程的单独连接上完成，成批的录像交给全局线程池并行解析。
+  查询用 buildLibraryQuery()/buildSearchQuery() 在调用方自己的连接上执行。
+  */
+class RecordingIndex : public QObject {
+  Q_OBJECT
+
+public:
+  enum Backend {
+    Plain,
+    Fts,
+    FtsTrigram,
+  };
+
+  RecordingIndex(const QString &dbPath, const QString &recordingDir,
+                 QObject *parent = nullptr);
+  ~RecordingIndex();
+
+  Backend backend() const { return type; }
+
+  // 录像文件已经写进 recording/ 之后调用
+  void addFile(const QString &fileName);
+  // raw 为存进 myGameRecordings 的原始数据
+  void addGame(int id, const QString &mode, const QString &general,
+               const QString &deputy, const QByteArray &raw);
+  void removeFile(const QString &fileName);
+  // 删掉 myGameRecordings 里已经没有的数据库录像，保留策略清理过之后调用
+  void purgeGames();
+  // 补上还没进索引或者已经变了的录像文件与数据库录像，删掉已经不存在的
+  void reconcile();
+  void wait();
+
+  // source 为 file/db 时只列出该来源的录像
+  static QString buildLibraryQuery(const QString &source, int limit);
+  static QString buildSearchQuery(const QString &query, int limit, Backend backend);
+
+private:
+  QString dbPath;
+  QString recordingDir;
+  std::unique_ptr<Sqlite3> db; // 建表之后只在工作线程中使用
+  QThreadPool pool;
+  Backend type;
+
+  struct Entry;
+  static Entry scan(const QString &source, const QString &ref, const QByteArray &raw);
+  static Entry scanFile(const QFileInfo &info);
+
+  Backend ensureSchema();
+  // 以下两个不开事务，由调用方包起来
+  void write(const Entry &e);
+  void insertRow(const QString &source, const QString &ref, const QString &name,
+                 const QStringList &players, const QStringList &generals,
+                 const QString &mode);
+  void reconcileFiles();
+  void reconcileGames();
+  void purgeDeletedGames();
+};
+
+#endif // _RECORDING_INDEX_H
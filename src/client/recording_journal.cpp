@@ -0,0 +1,235 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "client/recording_journal.h"
+#include "client/replay_format.h"
+#include "core/c-wrapper.h"
+
+static const QByteArray Magic = QByteArrayLiteral("FKJ1");
+
+static void writeFrame(QFile &file, char type, const QByteArray &payload) {
+  QByteArray head(1, type);
+  quint32 len = payload.size();
+  for (int i = 0; i < 4; i++) head.append(char((len >> (8 * i)) & 0xff));
+  file.write(head);
+  file.write(payload);
+}
+
+RecordingJournal::RecordingJournal(const QString &dbPath, const QString &journalDir,
+                                   const QString &recordingDir, QObject *parent)
+  : QObject(parent), dbPath(dbPath), journalDir(journalDir), recordingDir(recordingDir)
+{
+  // 单线程池就是写线程，日志的各帧按提交顺序写入
+  pool.setMaxThreadCount(1);
+  // Client 是在别的线程里构造再 moveToThread 的，定时器要作为子对象跟着走
+  flushTimer.setParent(this);
+  flushTimer.setInterval(FlushInterval);
+  connect(&flushTimer, &QTimer::timeout, this, &RecordingJournal::flush);
+}
+
+RecordingJournal::~RecordingJournal() {
+  // 退出时还在对局中的日志留着，下次启动按崩溃恢复
+  flush();
+  wait();
+}
+
+void RecordingJournal::wait() {
+  pool.waitForDone();
+}
+
+Sqlite3 *RecordingJournal::database() {
+  if (!db) {
+    db = std::make_unique<Sqlite3>(dbPath, QString());
+  }
+  return db.get();
+}
+
+void RecordingJournal::begin(const QByteArray &roomSettings, const QByteArray &playerInfo) {
+  if (active) abandon();
+  active = true;
+  buffer = QCborArray();
+
+  auto now = QDateTime::currentDateTime();
+  auto header = QCborArray {
+    QByteArray(FK_VERSION), now.toString("yyyyMMdd-HHmmss").toUtf8(),
+    roomSettings, playerInfo, 0, QByteArray("normal"),
+  }.toCborValue().toCbor();
+  auto path = QDir(journalDir).filePath(QString::number(now.toMSecsSinceEpoch()) + ".fkj");
+
+  pool.start([=, this]() {
+    QDir().mkpath(journalDir);
+    file.setFileName(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+      qWarning() << "Failed to open recording journal:" << path;
+      return;
+    }
+    file.write(Magic);
+    writeFrame(file, 'H', header);
+    writeFrame(file, 'S', QCborValue(now.toMSecsSinceEpoch()).toCbor());
+    file.flush();
+  });
+  flushTimer.start();
+}
+
+void RecordingJournal::append(qint64 elapsed, bool isRequest, const QByteArray &cmd,
+                              const QByteArray &data) {
+  if (!active) return;
+  buffer << QCborArray { elapsed, isRequest, cmd, data };
+  if (buffer.size() >= FlushEvents) flush();
+}
+
+void RecordingJournal::flush() {
+  if (buffer.isEmpty()) return;
+  auto events = buffer;
+  buffer = QCborArray();
+
+  pool.start([=, this]() {
+    if (!file.isOpen()) return;
+    writeFrame(file, 'E', qCompress(events.toCborValue().toCbor()));
+    file.flush();
+  });
+}
+
+void RecordingJournal::abandon() {
+  active = false;
+  flushTimer.stop();
+  buffer = QCborArray();
+
+  pool.start([this]() {
+    if (file.isOpen()) file.remove();
+  });
+}
+
+void RecordingJournal::keep() {
+  if (!active) return;
+  flush();
+  active = false;
+  flushTimer.stop();
+
+  pool.start([this]() {
+    if (file.isOpen()) file.close();
+  });
+}
+
+void RecordingJournal::commit(int id, const QByteArray &record) {
+  // Lua 整理好的录像为准，还没写出去的事件不要了
+  active = false;
+  flushTimer.stop();
+  buffer = QCborArray();
+
+  pool.start([=, this]() {
+    if (file.isOpen()) {
+      writeFrame(file, 'C', QCborValue(id).toCbor());
+      file.flush();
+    }
+
+    auto raw = ReplayFormat::encode(record);
+    if (!saveRecording(id, raw)) {
+      // 日志留着，下次启动再补
+      file.close();
+      return;
+    }
+    if (file.isOpen()) file.remove();
+    emit committed(id, raw);
+  });
+}
+
+void RecordingJournal::saveFile(const QString &fileName, const QByteArray &record) {
+  pool.start([=, this]() {
+    // encode() 里还要把 v2 解回来核对一遍，都不放在主线程上
+    QDir().mkpath(recordingDir);
+    QSaveFile out(QDir(recordingDir).filePath(fileName));
+    if (!out.open(QIODevice::WriteOnly)) {
+      qWarning() << "Failed to open file for writing:" << out.fileName();
+      return;
+    }
+    out.write(ReplayFormat::encode(record));
+    if (!out.commit()) {
+      qWarning() << "Failed to write recording:" << out.fileName();
+      return;
+    }
+    emit fileSaved(fileName);
+  });
+}
+
+bool RecordingJournal::saveRecording(int id, const QByteArray &raw) {
+  return database()->exec(QString("INSERT INTO myGameRecordings (id, recording) "
+                                  "VALUES (%1, x'%2');").arg(id).arg(raw.toHex()));
+}
+
+void RecordingJournal::recover() {
+  pool.start([this]() {
+    QDir dir(journalDir);
+    for (auto &info : dir.entryInfoList({ "*.fkj" }, QDir::Files, QDir::Name)) {
+      if (file.isOpen() && info.absoluteFilePath() == QFileInfo(file).absoluteFilePath())
+        continue;
+      recoverFile(info.absoluteFilePath());
+    }
+  });
+}
+
+void RecordingJournal::recoverFile(const QString &path) {
+  QFile f(path);
+  if (!f.open(QIODevice::ReadOnly)) return;
+  auto data = f.readAll();
+  f.close();
+
+  QCborArray arr;
+  int events = 0;
+  bool started = false;
+  qint64 id = -1;
+  qsizetype p = Magic.size();
+  while (data.startsWith(Magic) && p + 5 <= data.size()) {
+    auto type = data.at(p);
+    quint32 len = 0;
+    for (int i = 0; i < 4; i++) len |= quint32((uchar)data.at(p + 1 + i)) << (8 * i);
+    if (len > quint64(data.size() - p - 5)) break; // 写到一半的帧
+    auto payload = QByteArray::fromRawData(data.constData() + p + 5, len);
+    p += 5 + len;
+
+    if (type == 'H') {
+      arr = QCborValue::fromCbor(payload).toArray();
+    } else if (type == 'S') {
+      started = true;
+    } else if (type == 'E' && !arr.isEmpty()) {
+      for (auto e : QCborValue::fromCbor(qUncompress(payload)).toArray()) {
+        arr << e;
+        events++;
+      }
+    } else if (type == 'C') {
+      id = QCborValue::fromCbor(payload).toInteger(-1);
+    }
+  }
+
+  // 没开始游戏的（房间里的聊天、进出人之类）不算录像
+  if (!started || events == 0) {
+    QFile::remove(path);
+    return;
+  }
+
+  auto raw = ReplayFormat::encode(arr.toCborValue().toCbor());
+  if (id >= 0) {
+    auto ret = database()->select(QString(
+      "SELECT (SELECT count(*) FROM myGameRecordings WHERE id = %1) AS r, "
+      "(SELECT count(*) FROM myGameData WHERE id = %1) AS d;").arg(id));
+    if (!ret.isEmpty() && ret[0]["r"].toInt() > 0) {
+      QFile::remove(path);
+      return;
+    }
+    if (!ret.isEmpty() && ret[0]["d"].toInt() > 0 && saveRecording(id, raw)) {
+      QFile::remove(path);
+      emit committed(id, raw);
+      return;
+    }
+  }
+
+  // 没有战绩可挂的，存成录像文件
+  QDir().mkpath(recordingDir);
+  auto name = QString("recovered-%1.fk.rep").arg(QFileInfo(path).completeBaseName());
+  QSaveFile out(QDir(recordingDir).filePath(name));
+  if (!out.open(QIODevice::WriteOnly)) return;
+  out.write(raw);
+  if (!out.commit()) return;
+  QFile::remove(path);
+  qInfo() << "Recovered recording from journal:" << name;
+  emit recovered(name);
+}
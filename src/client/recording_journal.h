@@ -0,0 +1,88 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _RECORDING_JOURNAL_H
+#define _RECORDING_JOURNAL_H
+
+class Sqlite3;
+
+/**
+  对局录像的追加写日志。
+
+  录像本身仍由 Lua 整理，对局结束时交给 Client::saveGameData；这里另外把从服务器
+  收到的事件边收边写进 client/journal/ 下的日志文件，对局中途崩溃的话下次启动时
+  还能把录像恢复出来。日志格式：
+
+  ```
+  "FKJ1"
+  帧 * N：u8 类型 | u32(LE) 长度 | 内容
+    'H'  CBOR数组：录像文件头 [版本, 文件名, 房间设置, 玩家信息, 0, 录像类型]
+    'S'  CBOR整数：游戏开始的时间戳（毫秒）
+    'E'  qCompress(CBOR数组：若干事件 [时间戳, 是否request, 命令, CBOR参数])
+    'C'  CBOR整数：对局已存进 myGameData 的 id
+  ```
+
+  事件在主线程攒够 FlushEvents 个或每隔 FlushInterval 交给写线程压缩追加，
+  写完即 flush 给操作系统（不 fsync，防的是进程崩溃）。最后一帧写到一半时
+  恢复只读到它之前为止。日志在 StartGame 时开始，没有 'S' 帧的（比如旧版本
+  在房间里等人时就开始写的）不恢复。
+
+  commit() 之后编码 v2 录像、写入 myGameRecordings 都在写线程上做，
+  对局结束时主线程只插入战绩那一行。手动保存的录像文件（saveFile）也在
+  写线程上编码和写入。
+  */
+class RecordingJournal : public QObject {
+  Q_OBJECT
+
+public:
+  static constexpr int FlushEvents = 64;
+  static constexpr int FlushInterval = 2000; // 毫秒
+
+  RecordingJournal(const QString &dbPath, const QString &journalDir,
+                   const QString &recordingDir, QObject *parent = nullptr);
+  ~RecordingJournal();
+
+  bool isActive() const { return active; }
+
+  // 以下在主线程调用。begin() 在游戏开始时调用
+  void begin(const QByteArray &roomSettings, const QByteArray &playerInfo);
+  void append(qint64 elapsed, bool isRequest, const QByteArray &cmd, const QByteArray &data);
+  // 对局没有保存就结束了（回到大厅等），日志直接删掉
+  void abandon();
+  // 对局没能存进数据库：停止写入，日志留着，下次启动时 recover() 存成录像文件
+  void keep();
+  // record 为 Lua 整理好的录像CBOR，编码后存为 myGameRecordings 中 id 那一行
+  void commit(int id, const QByteArray &record);
+  // record 为 Lua 整理好的录像CBOR，编码后存为 recording/ 下的 fileName
+  void saveFile(const QString &fileName, const QByteArray &record);
+
+  // 恢复上次没有正常结束的日志：已经有战绩的补进 myGameRecordings，
+  // 否则存成 recording/ 下的录像文件
+  void recover();
+  void wait();
+
+signals:
+  // 以下在写线程中发出
+  void committed(int id, const QByteArray &raw);
+  void recovered(const QString &fileName);
+  void fileSaved(const QString &fileName);
+
+private:
+  QString dbPath;
+  QString journalDir;
+  QString recordingDir;
+  QThreadPool pool;
+  QTimer flushTimer;
+  bool active = false;
+  QCborArray buffer;
+
+  // 以下只在写线程中使用
+  std::unique_ptr<Sqlite3> db;
+  QFile file;
+
+  void flush();
+  Sqlite3 *database();
+  bool saveRecording(int id, const QByteArray &raw);
+  void recoverFile(const QString &path);
+};
+
+#endif // _RECORDING_JOURNAL_H
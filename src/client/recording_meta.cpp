@@ -0,0 +1,92 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "client/recording_meta.h"
+
+// CBOR里的字符串可能是text string也可能是byte string
+static QString cborString(const QCborValue &v) {
+  if (v.isString()) return v.toString();
+  if (v.isByteArray()) return QString::fromUtf8(v.toByteArray());
+  return QString();
+}
+
+static QString findGameMode(const QCborValue &v, int depth = 0) {
+  if (depth > 3) return QString();
+  if (v.isMap()) {
+    auto map = v.toMap();
+    auto mode = cborString(map.value(QStringLiteral("gameMode")));
+    if (!mode.isEmpty()) return mode;
+    for (auto it = map.cbegin(); it != map.cend(); it++) {
+      mode = findGameMode(it.value(), depth + 1);
+      if (!mode.isEmpty()) return mode;
+    }
+  } else if (v.isArray()) {
+    for (auto e : v.toArray()) {
+      auto mode = findGameMode(e, depth + 1);
+      if (!mode.isEmpty()) return mode;
+    }
+  }
+  return QString();
+}
+
+QString RecordingMeta::modeFromRoomSettings(const QByteArray &settings) {
+  QCborParserError err;
+  auto v = QCborValue::fromCbor(settings, &err);
+  if (err.error != QCborError::NoError) {
+    v = QCborValue::fromVariant(QJsonDocument::fromJson(settings).toVariant());
+  }
+  return findGameMode(v);
+}
+
+RecordingMeta RecordingMeta::fromCbor(const QByteArray &data) {
+  RecordingMeta meta;
+  auto arr = QCborValue::fromCbor(data).toArray();
+  if (arr.size() < 10) {
+    return meta;
+  }
+
+  meta.version = arr[0].toByteArray();
+  meta.name = cborString(arr[1]);
+  meta.roomSettings = arr[2].toByteArray();
+  meta.playerInfo = arr[3].toByteArray();
+  meta.recordType = arr[5].toByteArray();
+  meta.mode = modeFromRoomSettings(meta.roomSettings);
+
+  for (auto v : arr) {
+    if (!v.isArray()) continue;
+    auto a = v.toArray();
+    if (a.size() < 4) continue;
+    meta.addEvent(a[0].toInteger(), a[2].toByteArray(), a[3].toByteArray());
+  }
+  meta.finishEvents();
+
+  return meta;
+}
+
+void RecordingMeta::addEvent(qint64 elapsed, const QByteArray &cmd, const QByteArray &data) {
+  if (eventCount == 0) firstTimestamp = elapsed;
+  lastTimestamp = elapsed;
+  eventCount++;
+
+  if (cmd == "AddPlayer") {
+    auto args = QCborValue::fromCbor(data).toArray();
+    auto name = cborString(args.at(1));
+    if (!name.isEmpty() && !players.contains(name))
+      players << name;
+  } else if (cmd == "PropertyUpdate") {
+    auto args = QCborValue::fromCbor(data).toArray();
+    auto prop = cborString(args.at(1));
+    if (prop == "general" || prop == "deputyGeneral") {
+      auto general = cborString(args.at(2));
+      if (!general.isEmpty() && !generals.contains(general))
+        generals << general;
+    }
+  }
+}
+
+void RecordingMeta::finishEvents() {
+  // 自己不会收到针对自己的 AddPlayer
+  auto self = QCborValue::fromCbor(playerInfo).toArray();
+  auto selfName = cborString(self.at(1));
+  if (!selfName.isEmpty() && !players.contains(selfName))
+    players.prepend(selfName);
+}
@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _RECORDING_META_H
+#define _RECORDING_META_H
+
+/**
+  从录像（未压缩的CBOR数组，v2 录像先用 ReplayFormat::toCbor 转换）中提取用于检索和展示的信息。
+
+  录像格式：[版本, 文件名, 房间设置, 自己的玩家信息, ..., 录像类型, 事件...]
+  其中每个事件为 [时间戳, 是否request, 命令, CBOR参数]。
+  玩家名取自 AddPlayer，武将取自 PropertyUpdate 的 general/deputyGeneral。
+  */
+struct RecordingMeta {
+  QByteArray version;
+  QString name;
+  QByteArray roomSettings;
+  QByteArray playerInfo;
+  QByteArray recordType;
+  QString mode;
+  QStringList players;
+  QStringList generals;
+  qint64 firstTimestamp = 0;
+  qint64 lastTimestamp = 0;
+  int eventCount = 0;
+
+  bool isValid() const { return !version.isEmpty(); }
+
+  static RecordingMeta fromCbor(const QByteArray &data);
+  // 逐个事件收集，给流式读取（ReplayReader）用；fromCbor 也是这样做的。
+  // 事件读完之后调用 finishEvents()，从 playerInfo 补上自己
+  void addEvent(qint64 elapsed, const QByteArray &cmd, const QByteArray &data);
+  void finishEvents();
+  // 房间设置可能是CBOR也可能是JSON，在里面找 gameMode
+  static QString modeFromRoomSettings(const QByteArray &settings);
+};
+
+#endif // _RECORDING_META_H
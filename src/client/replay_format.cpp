@@ -0,0 +1,266 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "client/replay_format.h"
+
+static const QByteArray Magic = QByteArrayLiteral("FKR2");
+
+static void putVarint(QByteArray &out, quint64 v) {
+  while (v >= 0x80) {
+    out.append(char(v | 0x80));
+    v >>= 7;
+  }
+  out.append(char(v));
+}
+
+static quint64 zigzag(qint64 v) {
+  return (quint64(v) << 1) ^ quint64(v >> 63);
+}
+
+static qint64 unzigzag(quint64 v) {
+  return qint64(v >> 1) ^ -qint64(v & 1);
+}
+
+namespace {
+// 顺序读取 varint 和定长字节，越界后 ok 置 false，之后的读取都返回空
+struct Cursor {
+  const char *p;
+  const char *end;
+  bool ok = true;
+
+  Cursor(const QByteArray &data, qsizetype offset = 0)
+    : p(data.constData() + offset), end(data.constData() + data.size()) {}
+
+  quint64 varint() {
+    quint64 v = 0;
+    for (int shift = 0; ok && shift < 64; shift += 7) {
+      if (p >= end) break;
+      auto b = (uchar)*p++;
+      v |= quint64(b & 0x7f) << shift;
+      if (!(b & 0x80)) return v;
+    }
+    ok = false;
+    return 0;
+  }
+
+  QByteArray bytes(quint64 n) {
+    if (!ok || n > quint64(end - p)) {
+      ok = false;
+      return QByteArray();
+    }
+    QByteArray ret(p, n);
+    p += n;
+    return ret;
+  }
+};
+}
+
+static QByteArray cborBytes(const QCborValue &v) {
+  return v.isString() ? v.toString().toUtf8() : v.toByteArray();
+}
+
+bool ReplayFormat::isV2(const QByteArray &raw) {
+  return raw.size() > 13 && raw.startsWith(Magic) && raw.endsWith(Magic);
+}
+
+QByteArray ReplayFormat::encode(const QByteArray &cbor, int chunkEvents) {
+  QCborParserError err;
+  auto value = QCborValue::fromCbor(cbor, &err);
+  if (err.error != QCborError::NoError || value.toArray().size() < 10) {
+    return qCompress(cbor);
+  }
+  // v2 只认标准的录像结构：文件头在前、事件在后，命令和参数是字节串。
+  // 不是这样的录像编码后解不回原样，原样按 v1 保存
+  auto v2 = encodeV2(value.toArray(), chunkEvents);
+  if (QCborValue::fromCbor(toCbor(v2)) != value) {
+    qWarning("Replay does not round-trip through format v2, keeping v1");
+    return qCompress(cbor);
+  }
+  return v2;
+}
+
+QByteArray ReplayFormat::encodeV2(const QCborArray &arr, int chunkEvents) {
+  QByteArray out = Magic;
+  out.append(char(Version));
+
+  QCborArray header;
+  QHash<QByteArray, quint32> dictIndex;
+  QList<QByteArray> dict;
+  for (auto v : arr) {
+    if (!v.isArray()) {
+      header << v;
+      continue;
+    }
+    auto cmd = cborBytes(v.toArray().at(2));
+    if (!dictIndex.contains(cmd)) {
+      dictIndex[cmd] = dict.size();
+      dict << cmd;
+    }
+  }
+
+  auto h = qCompress(header.toCborValue().toCbor());
+  putVarint(out, h.size());
+  out += h;
+
+  putVarint(out, dict.size());
+  for (auto &cmd : dict) {
+    putVarint(out, cmd.size());
+    out += cmd;
+  }
+
+  QList<ChunkInfo> chunks;
+  QList<QCborArray> pending;
+  quint32 total = 0;
+  auto flush = [&]() {
+    if (pending.isEmpty()) return;
+    QByteArray payload;
+    putVarint(payload, pending.size());
+    qint64 prev = 0;
+    for (auto &e : pending) {
+      auto t = e.at(0).toInteger();
+      putVarint(payload, zigzag(t - prev));
+      prev = t;
+    }
+    QByteArray bitmap((pending.size() + 7) / 8, 0);
+    for (int i = 0; i < pending.size(); i++) {
+      if (pending[i].at(1).toBool()) bitmap[i / 8] = bitmap[i / 8] | char(1 << (i % 8));
+    }
+    payload += bitmap;
+    for (auto &e : pending) putVarint(payload, dictIndex[cborBytes(e.at(2))]);
+    QList<QByteArray> data;
+    for (auto &e : pending) {
+      data << cborBytes(e.at(3));
+      putVarint(payload, data.last().size());
+    }
+    for (auto &d : data) payload += d;
+
+    chunks << ChunkInfo { out.size(), total, (quint32)pending.size(),
+                          pending.first().at(0).toInteger() };
+    total += pending.size();
+    auto c = qCompress(payload, 9);
+    putVarint(out, c.size());
+    out += c;
+    pending.clear();
+  };
+
+  for (auto v : arr) {
+    if (!v.isArray()) continue;
+    pending << v.toArray();
+    if (pending.size() >= chunkEvents) flush();
+  }
+  flush();
+
+  QByteArray footer;
+  putVarint(footer, chunks.size());
+  for (auto &c : chunks) {
+    putVarint(footer, c.offset);
+    putVarint(footer, c.count);
+    putVarint(footer, zigzag(c.firstElapsed));
+  }
+  out += footer;
+  quint32 len = footer.size();
+  for (int i = 0; i < 4; i++) out.append(char((len >> (8 * i)) & 0xff));
+  out += Magic;
+  return out;
+}
+
+bool ReplayFormat::readLayout(const QByteArray &raw, QCborArray &header,
+                              QList<QByteArray> &commands, QList<ChunkInfo> &chunks) {
+  if (!isV2(raw) || raw.at(4) != Version) return false;
+
+  quint32 len = 0;
+  for (int i = 0; i < 4; i++) len |= quint32((uchar)raw.at(raw.size() - 8 + i)) << (8 * i);
+  qsizetype footerStart = raw.size() - 8 - len;
+  if (footerStart < 5) return false;
+
+  Cursor f(raw, footerStart);
+  auto n = f.varint();
+  chunks.clear();
+  quint32 first = 0;
+  for (quint64 i = 0; f.ok && i < n; i++) {
+    ChunkInfo c;
+    c.offset = f.varint();
+    c.count = f.varint();
+    c.firstElapsed = unzigzag(f.varint());
+    c.first = first;
+    first += c.count;
+    if (c.offset >= footerStart) f.ok = false;
+    chunks << c;
+  }
+  if (!f.ok) return false;
+
+  Cursor c(raw, 5);
+  auto h = qUncompress(c.bytes(c.varint()));
+  header = QCborValue::fromCbor(h).toArray();
+  auto count = c.varint();
+  commands.clear();
+  for (quint64 i = 0; c.ok && i < count; i++) {
+    commands << c.bytes(c.varint());
+  }
+  return c.ok;
+}
+
+bool ReplayFormat::readChunk(const QByteArray &raw, const ChunkInfo &info, Chunk &out,
+                             bool withData) {
+  Cursor c(raw, info.offset);
+  out.payload = qUncompress(c.bytes(c.varint()));
+  auto &payload = out.payload;
+  if (!c.ok || payload.isEmpty()) return false;
+
+  Cursor p(payload);
+  auto n = p.varint();
+  if (n != info.count) return false;
+
+  out.elapsed.resize(n);
+  out.isRequest.resize(n);
+  out.cmd.resize(n);
+  qint64 t = 0;
+  for (quint64 i = 0; i < n; i++) {
+    t += unzigzag(p.varint());
+    out.elapsed[i] = t;
+  }
+  auto bitmap = p.bytes((n + 7) / 8);
+  for (quint64 i = 0; p.ok && i < n; i++) {
+    out.isRequest[i] = bitmap.at(i / 8) & (1 << (i % 8));
+  }
+  for (quint64 i = 0; i < n; i++) out.cmd[i] = p.varint();
+
+  out.dataOffset.clear();
+  if (withData) {
+    out.dataOffset.resize(n + 1);
+    quint64 total = 0;
+    for (quint64 i = 0; i < n; i++) {
+      out.dataOffset[i] = total;
+      total += p.varint();
+    }
+    // 参数字节紧跟在长度后面，按偏移记下即可
+    qsizetype base = p.p - payload.constData();
+    if (!p.ok || total > quint64(p.end - p.p)) return false;
+    for (auto &off : out.dataOffset) off += base;
+    out.dataOffset[n] = base + total;
+  } else {
+    out.payload.clear();
+  }
+  return p.ok;
+}
+
+QByteArray ReplayFormat::toCbor(const QByteArray &raw) {
+  if (!isV2(raw)) return qUncompress(raw);
+
+  QCborArray header;
+  QList<QByteArray> commands;
+  QList<ChunkInfo> chunks;
+  if (!readLayout(raw, header, commands, chunks)) return QByteArray();
+
+  auto arr = header;
+  for (auto &info : chunks) {
+    Chunk chunk;
+    if (!readChunk(raw, info, chunk)) return QByteArray();
+    for (int i = 0; i < chunk.elapsed.size(); i++) {
+      arr << QCborArray {
+        chunk.elapsed[i], chunk.isRequest[i],
+        commands.value(chunk.cmd[i]), chunk.data(i),
+      };
+    }
+  }
+  return arr.toCborValue().toCbor();
+}
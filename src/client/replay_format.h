@@ -0,0 +1,74 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _REPLAY_FORMAT_H
+#define _REPLAY_FORMAT_H
+
+/**
+  录像格式 v2。
+
+  v1 是 qCompress(CBOR数组)，每个事件都重复带着完整的命令名和一段CBOR参数。
+  v2 按列存储、分块压缩：
+
+  ```
+  "FKR2" | u8 版本
+  varint 长度 + qCompress(CBOR数组：v1 中除事件外的顶层元素，即文件头)
+  varint 命令数 + 每个命令 (varint 长度 + 字节)      -- 命令字典
+  块 * N：varint 长度 + qCompress(
+      varint 事件数
+      zigzag varint 时间戳差分（第一个相对 0）
+      isRequest 位图
+      varint 命令编号
+      varint 参数长度
+      参数字节依次拼接)
+  块索引：varint 块数，每块 varint 文件偏移、varint 事件数、zigzag varint 首个时间戳
+  u32(LE) 块索引长度 | "FKR2"
+  ```
+
+  同一列的数据放在一起压缩效果更好；按块压缩则可以只解压需要的部分。
+  读取见 ReplayReader，它同时支持 v1 和 v2。
+  */
+class ReplayFormat {
+public:
+  static constexpr int Version = 2;
+  static constexpr int ChunkEvents = 512;
+
+  static bool isV2(const QByteArray &raw);
+  // cbor 为 v1 未压缩的CBOR。编码后会解回来核对，解析失败或者解不回原样时
+  // 原样按 v1 压缩，所以结果总能用 toCbor() 还原
+  static QByteArray encode(const QByteArray &cbor, int chunkEvents = ChunkEvents);
+  // 任意格式的录像转回 v1 未压缩的CBOR，给只认识CBOR的代码用
+  static QByteArray toCbor(const QByteArray &raw);
+
+  struct ChunkInfo {
+    qint64 offset;
+    quint32 first; // 首个事件的序号
+    quint32 count;
+    qint64 firstElapsed;
+  };
+
+  // 参数不逐个复制：payload 就是解压出来的整块数据，data(i) 是指向其中的视图，
+  // 只在 payload 还在时有效
+  struct Chunk {
+    QList<qint64> elapsed;
+    QList<bool> isRequest;
+    QList<quint32> cmd;
+    QByteArray payload;
+    QList<quint32> dataOffset; // 事件数 + 1 个
+
+    QByteArray data(qsizetype i) const {
+      return QByteArray::fromRawData(payload.constData() + dataOffset[i],
+                                     dataOffset[i + 1] - dataOffset[i]);
+    }
+  };
+
+  // 以下供 ReplayReader 使用
+  static bool readLayout(const QByteArray &raw, QCborArray &header,
+                         QList<QByteArray> &commands, QList<ChunkInfo> &chunks);
+  static bool readChunk(const QByteArray &raw, const ChunkInfo &info, Chunk &out,
+                        bool withData = true);
+
+private:
+  static QByteArray encodeV2(const QCborArray &arr, int chunkEvents);
+};
+
+#endif // _REPLAY_FORMAT_H
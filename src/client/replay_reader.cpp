@@ -0,0 +1,248 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "client/replay_reader.h"
+
+// 录像里的字符串字段可能是byte string也可能是text string
+static QByteArray readBytes(QCborStreamReader &r) {
+  if (r.isByteArray()) return r.readAllByteArray();
+  if (r.isString()) return r.readAllUtf8String();
+  r.next();
+  return QByteArray();
+}
+
+QByteArray ReplayReader::viewBytes(QCborStreamReader &r, qsizetype base) const {
+  // 定长的字符串直接指向 data 里的内容；分段编码的只能读出来拼起来
+  if ((r.isByteArray() || r.isString()) && r.isLengthKnown()) {
+    auto at = base + r.currentOffset();
+    auto info = (uchar)data.at(at) & 0x1f;
+    qsizetype head = info < 24 ? 1 : info == 24 ? 2 : info == 25 ? 3 : info == 26 ? 5 : 9;
+    auto len = (qsizetype)r.length();
+    if (at + head + len <= data.size()) {
+      r.next();
+      return QByteArray::fromRawData(data.constData() + at + head, len);
+    }
+  }
+  return readBytes(r);
+}
+
+bool ReplayReader::open(const QByteArray &raw) {
+  valid = false;
+  current = ReplayFormat::Chunk();
+  currentChunk = -1;
+  if (ReplayFormat::isV2(raw)) {
+    // raw 可能指向映射的文件，复制一份
+    data = QByteArray(raw.constData(), raw.size());
+    QCborArray header;
+    if (!ReplayFormat::readLayout(data, header, commands, chunks))
+      return false;
+    auto field = [&](int i) {
+      auto v = header.at(i);
+      return v.isString() ? v.toString().toUtf8() : v.toByteArray();
+    };
+    version = field(0);
+    fileName = field(1);
+    roomSettings = field(2);
+    playerInfo = field(3);
+    recordType = field(5);
+    total = chunks.isEmpty() ? 0 : chunks.last().first + chunks.last().count;
+    v2 = valid = true;
+    firstOffset = pos = 0;
+    return true;
+  }
+
+  data = qUncompress(raw);
+
+  QCborStreamReader r(data);
+  if (!r.isArray() || (r.isLengthKnown() && r.length() < 10) || !r.enterContainer())
+    return false;
+  firstOffset = pos = r.currentOffset();
+
+  // 文件头：[版本, 文件名, 房间设置, 自己的玩家信息, ?, 录像类型, ...]
+  for (int i = 0; i < 6 && r.hasNext(); i++) {
+    auto v = readBytes(r);
+    switch (i) {
+    case 0: version = v; break;
+    case 1: fileName = v; break;
+    case 2: roomSettings = v; break;
+    case 3: playerInfo = v; break;
+    case 5: recordType = v; break;
+    default: break;
+    }
+  }
+  if (r.lastError() != QCborError::NoError)
+    return false;
+
+  valid = true;
+  return true;
+}
+
+bool ReplayReader::atEnd(qsizetype offset) const {
+  if (v2) return offset < 0 || offset >= total;
+  // 定长数组结束于数据末尾，不定长数组以 0xff 结尾
+  return offset < 0 || offset >= data.size() || (uchar)data.at(offset) == 0xff;
+}
+
+qsizetype ReplayReader::decodeAt(qsizetype offset, Event &e, bool full, bool &isEvent) const {
+  QCborStreamReader r(QByteArray::fromRawData(data.constData() + offset, data.size() - offset));
+  isEvent = r.isArray();
+  if (!isEvent) {
+    r.next();
+  } else if (r.enterContainer()) {
+    // [时间戳, 是否request, 命令, CBOR参数]
+    for (int i = 0; r.hasNext(); i++) {
+      if (i == 0 && r.isInteger()) {
+        e.elapsed = r.toInteger();
+        r.next();
+      } else if (i == 1 && r.isBool()) {
+        e.isRequest = r.toBool();
+        r.next();
+      } else if (full && i == 2) {
+        e.cmd = viewBytes(r, offset);
+      } else if (full && i == 3) {
+        e.data = viewBytes(r, offset);
+      } else {
+        r.next();
+      }
+    }
+    r.leaveContainer();
+  }
+
+  if (r.lastError() != QCborError::NoError)
+    return -1;
+  return offset + r.currentOffset();
+}
+
+int ReplayReader::findChunk(quint32 n) const {
+  auto it = std::upper_bound(chunks.cbegin(), chunks.cend(), n,
+    [](quint32 n, const ReplayFormat::ChunkInfo &c) { return n < c.first; });
+  return int(it - chunks.cbegin()) - 1;
+}
+
+bool ReplayReader::next(Event &e) {
+  if (v2) {
+    if (!valid || atEnd(pos)) return false;
+    auto idx = findChunk(pos);
+    auto &chunk = current;
+    if (idx != currentChunk) {
+      // 换块时上一块就不要了，之前给出的参数视图随之失效
+      currentChunk = idx;
+      if (!ReplayFormat::readChunk(data, chunks[idx], chunk)) {
+        qWarning() << "Corrupted replay chunk" << idx;
+        chunk = ReplayFormat::Chunk();
+        currentChunk = -1;
+        pos = total;
+        return false;
+      }
+    }
+    auto i = pos - chunks[idx].first;
+    e.elapsed = chunk.elapsed[i];
+    e.isRequest = chunk.isRequest[i];
+    e.cmd = commands.value(chunk.cmd[i]);
+    e.data = chunk.data(i);
+    pos++;
+    return true;
+  }
+
+  while (valid && !atEnd(pos)) {
+    bool isEvent;
+    e = Event();
+    auto n = decodeAt(pos, e, true, isEvent);
+    if (n < 0) {
+      qWarning() << "Corrupted replay data at offset" << pos;
+      pos = data.size();
+      return false;
+    }
+    pos = n;
+    if (isEvent) return true;
+  }
+  return false;
+}
+
+bool ReplayReader::readAt(quint32 offset, Event &e) const {
+  if (v2) {
+    ReplayFormat::Chunk c;
+    auto idx = findChunk(offset);
+    if (atEnd(offset) || idx < 0 || !ReplayFormat::readChunk(data, chunks[idx], c))
+      return false;
+    auto i = offset - chunks[idx].first;
+    e.elapsed = c.elapsed[i];
+    e.isRequest = c.isRequest[i];
+    e.cmd = commands.value(c.cmd[i]);
+    // c 马上就没了，这里要复制
+    e.data = QByteArray(c.data(i).constData(), c.data(i).size());
+    return true;
+  }
+
+  bool isEvent = false;
+  return !atEnd(offset) && decodeAt(offset, e, true, isEvent) >= 0 && isEvent;
+}
+
+bool ReplayReader::timeRange(qint64 &first, qint64 &last) const {
+  if (!valid) return false;
+  if (v2) {
+    ReplayFormat::Chunk c;
+    if (chunks.isEmpty() || !ReplayFormat::readChunk(data, chunks.last(), c, false))
+      return false;
+    first = chunks.first().firstElapsed;
+    last = c.elapsed.last();
+    return true;
+  }
+
+  bool found = false;
+  auto offset = firstOffset;
+  while (!atEnd(offset)) {
+    Event e;
+    bool isEvent;
+    auto n = decodeAt(offset, e, false, isEvent);
+    if (n < 0) break;
+    if (isEvent) {
+      if (!found) first = e.elapsed;
+      last = e.elapsed;
+      found = true;
+    }
+    offset = n;
+  }
+  return found;
+}
+
+void ReplayReader::buildIndex(const std::atomic_bool &cancel) {
+  if (!valid || ready) return;
+
+  QList<IndexEntry> list;
+  if (v2) {
+    list.reserve(total);
+    for (auto &info : chunks) {
+      ReplayFormat::Chunk c;
+      if (cancel || !ReplayFormat::readChunk(data, info, c, false)) break;
+      for (quint32 i = 0; i < info.count; i++) {
+        list << IndexEntry { c.elapsed[i], info.first + i, c.isRequest[i] };
+      }
+    }
+    if (cancel) return;
+    entries = std::move(list);
+    ready = true;
+    return;
+  }
+
+  // 每个事件至少占十几个字节，按此预估省去多次扩容
+  list.reserve(data.size() / 64);
+  auto offset = firstOffset;
+  while (!atEnd(offset) && !cancel) {
+    Event e;
+    bool isEvent;
+    auto n = decodeAt(offset, e, false, isEvent);
+    if (n < 0) break;
+    if (isEvent) list << IndexEntry { e.elapsed, (quint32)offset, e.isRequest };
+    offset = n;
+  }
+  if (cancel) return;
+
+  list.squeeze();
+  entries = std::move(list);
+  ready = true;
+}
+
+qint64 ReplayReader::duration() const {
+  if (!ready || entries.isEmpty()) return 0;
+  return entries.last().elapsed - entries.first().elapsed;
+}
@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _REPLAY_READER_H
+#define _REPLAY_READER_H
+
+#include "client/replay_format.h"
+
+/**
+  录像的流式读取。
+
+  录像是 qCompress 过的 CBOR 数组（格式见 recording_meta.h）。qCompress 的结果
+  是一整段 zlib 数据，没法从中间开始解，所以 v1 只能一次解压完；之后用
+  QCborStreamReader 按需逐条解码事件，不再把整个文档建成 QCborValue 树、
+  也不再为每个事件复制一份命令和参数。
+
+  事件的偏移和时间戳另外建一份紧凑的索引（buildIndex，可以在后台线程做），
+  用于计算时长和跳转；顺序播放不依赖索引，解出第一个事件就能开始。
+
+  v2 格式（见 replay_format.h）则保持压缩状态放在内存里，用到哪块解压哪块，
+  同一时刻只留着 next() 正在读的那一块，内存占用是一块解压后的大小。
+  对 v1，位置（offset）是事件在解压后数据中的字节偏移；对 v2 是事件序号。
+
+  next() 给出的命令和参数不单独分配内存，都是指向解压后数据的视图：v1 的
+  在 reader 的生命期内都有效；v2 的参数指向当前块的 payload，next() 读进
+  下一块（或者 seek 到别的块）之后就失效了。要留得更久的话自己复制一份。
+  */
+class ReplayReader {
+public:
+  struct Event {
+    qint64 elapsed = 0;
+    bool isRequest = false;
+    QByteArray cmd;
+    QByteArray data;
+  };
+
+  struct IndexEntry {
+    qint64 elapsed;
+    quint32 offset;
+    bool isRequest;
+  };
+
+  // raw 为录像文件/数据库中的原始数据；解析出文件头即返回
+  bool open(const QByteArray &raw);
+  bool isValid() const { return valid; }
+
+  QByteArray version;
+  QByteArray fileName;
+  QByteArray roomSettings;
+  QByteArray playerInfo;
+  QByteArray recordType = "normal";
+
+  // 顺序读取下一个事件，没有了返回 false
+  bool next(Event &e);
+  // 把顺序读取的位置移到某个事件（offset 取自索引）
+  void seek(quint32 offset) { pos = offset; }
+  void rewind() { pos = firstOffset; }
+  quint32 position() const { return pos; }
+  bool readAt(quint32 offset, Event &e) const;
+
+  // 第一个和最后一个事件的时间戳，不需要索引；v2 只解压最后一块
+  bool timeRange(qint64 &first, qint64 &last) const;
+
+  // 扫描全部事件建索引，可以在别的线程调用；cancel 置位时提前返回
+  void buildIndex(const std::atomic_bool &cancel);
+  bool indexReady() const { return ready; }
+  // 以下在 indexReady() 之后才能用
+  const QList<IndexEntry> &index() const { return entries; }
+  qint64 duration() const;
+
+private:
+  QByteArray data; // v1 为解压后的CBOR，v2 为原始数据；只读，各线程共享
+  bool valid = false;
+  bool v2 = false;
+  QList<QByteArray> commands;
+  QList<ReplayFormat::ChunkInfo> chunks;
+  quint32 total = 0;
+  // next() 正在读的块，只在顺序读取的线程中使用
+  ReplayFormat::Chunk current;
+  int currentChunk = -1;
+  qsizetype firstOffset = 0;
+  qsizetype pos = 0;
+  QList<IndexEntry> entries;
+  std::atomic_bool ready = false;
+
+  // 解码 offset 处的一个顶层元素，返回下一个元素的偏移，出错返回 -1。
+  // 是事件时 isEvent 置 true；full 为 false 时只读时间戳和 isRequest
+  qsizetype decodeAt(qsizetype offset, Event &e, bool full, bool &isEvent) const;
+  QByteArray viewBytes(QCborStreamReader &r, qsizetype base) const;
+  bool atEnd(qsizetype offset) const;
+  int findChunk(quint32 n) const;
+};
+
+#endif // _REPLAY_READER_H
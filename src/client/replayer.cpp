@@ -6,8 +6,16 @@
 #include "core/util.h"
 #include "core/c-wrapper.h"
 
+#include <QtConcurrent>
+
+// command_parsed 排队到主线程执行，而 reader 给出的参数只是视图，
+// 读到下一块录像数据时就失效了，排队之前要复制一份
+static QByteArray ownBytes(const QByteArray &view) {
+  return QByteArray(view.constData(), view.size());
+}
+
 Replayer::Replayer(QObject *parent, const QString &filename) :
-  QThread(parent), fileName(filename), roomSettings(""), origPlayerInfo(""),
+  QThread(parent), fileName(filename), origPlayerInfo(""),
   playing(true), killed(false), speed(1.0), uniformRunning(false)
 {
   setObjectName("Replayer");
@@ -22,164 +30,315 @@ Replayer::Replayer(QObject *parent, const QString &filename) :
     qWarning() << "Failed to open replay file:" << file.fileName();
     return;
   }
-  QByteArray raw = file.readAll();
+  // 映射文件，省掉一次读入整个压缩数据的复制
+  auto size = file.size();
+  auto map = file.map(0, size);
+  if (map) {
+    loadRawData(QByteArray::fromRawData((const char *)map, size));
+    file.unmap(map);
+  } else {
+    loadRawData(file.readAll());
+  }
   file.close();
-  loadRawData(raw);
 }
 
 Replayer::Replayer(QObject *parent, int id) :
-  QThread(parent), fileName(""), roomSettings(""), origPlayerInfo(""),
+  QThread(parent), fileName(""), origPlayerInfo(""),
   playing(true), killed(false), speed(1.0), uniformRunning(false)
 {
   setObjectName("Replayer");
   auto result = ClientInstance->database().select(QString(
     "SELECT hex(recording) as r FROM myGameRecordings WHERE id = %1;").arg(id));
+  // 录像库里的条目可能比录像本身多活一会儿（保留策略刚清理掉）
+  if (result.isEmpty()) {
+    qWarning() << "Replay not found in database:" << id;
+    return;
+  }
   auto raw = QByteArray::fromHex(result[0]["r"].toLatin1());
   loadRawData(raw);
 }
 
-void Replayer::loadRawData(const QByteArray &raw) {
-  auto data = qUncompress(raw);
+Replayer::Replayer(QObject *parent, const QByteArray &raw) :
+  QThread(parent), fileName(""), origPlayerInfo(""),
+  playing(true), killed(false), speed(1.0), uniformRunning(false)
+{
+  setObjectName("Replayer");
+  loadRawData(raw);
+}
 
-  auto doc = QCborValue::fromCbor(data);
-  auto arr = doc.toArray();
-  if (arr.size() < 10) {
+void Replayer::loadRawData(const QByteArray &raw) {
+  if (!reader.open(raw)) {
     return;
   }
 
-  auto ver = arr[0].toByteArray();
-  if (ver != FK_VERSION) {
+  if (reader.version != FK_VERSION) {
     emit ClientInstance->toast_message(
       "Warning: Mismatch version of replay detected, which may cause crashes.");
   }
 
-  roomSettings = arr[2].toByteArray();
-  recordType = arr[5].toByteArray();
-
-  for (auto v : arr) {
-    if (!v.isArray()) {
-      continue;
-    }
-
-    auto a = v.toArray();
-    Pair *pair = new Pair;
-    pair->elapsed = a[0].toInteger();
-    pair->isRequest = a[1].toBool();
-    pair->cmd = a[2].toByteArray();
-    pair->jsonData = a[3].toByteArray();
-    pairs << pair;
-  }
+  // 时长要扫完全部事件才知道，放到后台去算，不耽误开始播放
+  indexing = QtConcurrent::run([this]() {
+    reader.buildIndex(cancelIndex);
+    if (reader.indexReady())
+      emit duration_set(getDuration());
+  });
 
   connect(this, &Replayer::command_parsed, this, [](const QByteArray &c, const QByteArray &j) {
     ClientInstance->callLua(c, j);
   });
 
-  auto playerInfoRaw = arr[3].toByteArray();
-  auto playerInfo = QCborValue::fromCbor(playerInfoRaw).toArray();
   auto self = ClientInstance->getSelf();
   origPlayerInfo = QCborArray({
     self->getId(), self->getScreenName(), self->getAvatar()
   }).toCborValue().toCbor();
-  emit command_parsed("Setup", playerInfoRaw);
+  emit command_parsed("Setup", reader.playerInfo);
+
+  // 跳转需要 Lua 端能导出/恢复客户端状态（目前的 Lua 端还没有），没有就不能跳转
+  snapshotSupported = ClientInstance->getLua()->eval(
+    "return type(GetClientSnapshot) == 'function' "
+    "and type(RestoreClientSnapshot) == 'function'").toBool();
 }
 
 Replayer::~Replayer() {
+  cancelIndex = true;
+  indexing.waitForFinished();
+  if (driftCount > 0) {
+    auto stats = driftStats();
+    qInfo("replay drift: %lld events, mean %.1f ms, max %.1f ms",
+          stats["events"].toLongLong(), stats["meanMs"].toDouble(), stats["maxMs"].toDouble());
+  }
   if (origPlayerInfo != "") {
     emit command_parsed("Setup", origPlayerInfo);
   }
-  for (auto e : pairs) {
-    delete e;
-  }
 }
 
 int Replayer::getDuration() const {
-  qint64 ret = (pairs.last()->elapsed - pairs.first()->elapsed) / 1000.0;
-  return (int)ret;
+  return (int)(reader.duration() / 1000);
 }
 
 qreal Replayer::getSpeed() {
-  qreal speed;
-  mutex.lock();
-  speed = this->speed;
-  mutex.unlock();
   return speed;
 }
 
-void Replayer::uniform() {
-  mutex.lock();
+QVariantMap Replayer::driftStats() const {
+  qint64 n = driftCount;
+  return {
+    { "events", n },
+    { "meanMs", n > 0 ? driftSum / 1000.0 / n : 0.0 },
+    { "maxMs", driftMax / 1000.0 },
+  };
+}
 
-  uniformRunning = !uniformRunning;
+void Replayer::post(const std::function<void()> &func) {
+  QMutexLocker locker(&schedulerLock);
+  if (scheduler)
+    QMetaObject::invokeMethod(scheduler, func, Qt::QueuedConnection);
+}
 
-  mutex.unlock();
+void Replayer::uniform() {
+  uniformRunning = !uniformRunning;
 }
 
 void Replayer::speedUp() {
-  mutex.lock();
-
-  if (speed < 16.0) {
-    qreal inc = speed >= 2.0 ? 1.0 : 0.5;
-    speed += inc;
-    emit speed_changed(speed);
+  qreal s = speed;
+  if (s < 16.0) {
+    s += s >= 2.0 ? 1.0 : 0.5;
+    speed = s;
+    emit speed_changed(s);
+    post([this]() { reschedule(); });
   }
-
-  mutex.unlock();
 }
 
 void Replayer::slowDown() {
-  mutex.lock();
-
-  if (speed >= 1.0) {
-    qreal dec = speed > 2.0 ? 1.0 : 0.5;
-    speed -= dec;
-    emit speed_changed(speed);
+  qreal s = speed;
+  if (s >= 1.0) {
+    s -= s > 2.0 ? 1.0 : 0.5;
+    speed = s;
+    emit speed_changed(s);
+    post([this]() { reschedule(); });
   }
-
-  mutex.unlock();
 }
 
 void Replayer::toggle() {
   playing = !playing;
-  if (playing)
-    play_sem.release();
+  post([this]() { reschedule(); });
 }
 
 void Replayer::shutdown() {
   killed = true;
+  quit();
 }
 
-void Replayer::run() {
-  qint64 last = 0;
-  qint64 start = 0;
+void Replayer::seek(int secs) {
+  seekTarget = qMax(0, secs);
+  post([this]() { handleSeek(); });
+}
 
-  if (roomSettings == "") {
-    emit ClientInstance->toast_message("Invalid replay file.");
-    deleteLater();
+void Replayer::enterRoom() {
+  auto connType = qApp->thread() == QThread::currentThread()
+    ? Qt::DirectConnection : Qt::BlockingQueuedConnection;
+  QMetaObject::invokeMethod(qApp, [&]() {
+    emit command_parsed("EnterRoom", reader.roomSettings);
+  }, connType);
+
+  emit command_parsed("StartGame", "\x40");
+}
+
+void Replayer::maybeKeyframe(qint64 elapsed, quint32 offset) {
+  if (!snapshotSupported) return;
+  if (!keyframes.isEmpty() && (offset <= keyframes.last().offset ||
+      elapsed - keyframes.last().elapsed < KeyframeInterval))
     return;
-  }
 
-  if (recordType == "normal") {
-    auto connType = qApp->thread() == QThread::currentThread()
-      ? Qt::DirectConnection : Qt::BlockingQueuedConnection;
-    QMetaObject::invokeMethod(qApp, [&]() {
-      emit command_parsed("EnterRoom", roomSettings);
-    }, connType);
+  // command_parsed 是排队到主线程的，这里同样排队并等待，
+  // 拿到的就是之前所有事件都执行完之后的状态
+  QVariant state;
+  QMetaObject::invokeMethod(qApp, [&]() {
+    state = ClientInstance->getLua()->call("GetClientSnapshot");
+  }, Qt::BlockingQueuedConnection);
 
-    emit command_parsed("StartGame", "\x40");
+  if (!state.isValid()) {
+    snapshotSupported = false;
+    emit seekable_changed(false);
+    return;
   }
+  keyframes << Keyframe { elapsed, offset, state };
+}
 
-  emit speed_changed(getSpeed());
-  emit duration_set(getDuration());
+bool Replayer::seekTo(qint64 target) {
+  const Keyframe *kf = nullptr;
+  for (auto &k : keyframes) {
+    if (k.elapsed > target) break;
+    kf = &k;
+  }
 
-  for (auto pair : pairs) {
-    if (killed) {
-      break;
+  if (target < last || (kf && kf->offset > reader.position())) {
+    if (kf) {
+      auto state = kf->state;
+      QMetaObject::invokeMethod(qApp, [&]() {
+        ClientInstance->getLua()->call("RestoreClientSnapshot", { state });
+      }, Qt::BlockingQueuedConnection);
+      reader.seek(kf->offset);
+    } else if (reader.recordType == "normal") {
+      // 没有可用的关键帧，重新进房间从头来
+      enterRoom();
+      reader.rewind();
+    } else {
+      return false;
     }
+  }
 
-    if (pair->isRequest) {
-      continue;
+  // 快进到目标时间，不等待；途中照样记关键帧，下次跳转更快
+  ReplayReader::Event ev;
+  forever {
+    auto offset = reader.position();
+    if (!reader.next(ev)) break;
+    if (ev.elapsed > target) {
+      reader.seek(offset);
+      break;
     }
+    if (ev.isRequest) continue;
+    maybeKeyframe(ev.elapsed, offset);
+    emit command_parsed(ev.cmd, ownBytes(ev.data));
+  }
 
-    qint64 delay = pair->elapsed - last;
+  last = target;
+  emit elasped((target - start) / 1000);
+  return true;
+}
+
+Replayer::VerifyResult Replayer::verify() {
+  VerifyResult ret;
+  if (!reader.isValid() || reader.roomSettings.isEmpty()) {
+    return ret;
+  }
+
+  // 在主线程上调用时 command_parsed 是直连的，事件一个个同步执行完
+  auto L = ClientInstance->getLua();
+  auto errors = L->errorCount();
+  QElapsedTimer timer;
+  timer.start();
+
+  if (reader.recordType == "normal") {
+    enterRoom();
+  }
+
+  ReplayReader::Event ev;
+  while (reader.next(ev)) {
+    if (ev.isRequest) continue;
+    emit command_parsed(ev.cmd, ev.data);
+    ret.events++;
+  }
+
+  ret.elapsed = timer.elapsed();
+  if (snapshotSupported) {
+    auto state = L->call("GetClientSnapshot");
+    ret.stateHash = QCryptographicHash::hash(QCborValue::fromVariant(state).toCbor(),
+                                             QCryptographicHash::Sha1).toHex();
+  }
+  ret.luaErrors = L->errorCount() - errors;
+  ret.valid = true;
+  return ret;
+}
+
+qint64 Replayer::virtNow() const {
+  if (paused) return anchorVirt;
+  return anchorVirt + (clock.nsecsElapsed() - anchorWall) * anchorSpeed / 1000000;
+}
+
+qint64 Replayer::deadlineOf(qint64 v) const {
+  return anchorWall + qint64((v - anchorVirt) * 1000000 / anchorSpeed);
+}
+
+void Replayer::reschedule() {
+  // 以当前时刻、当前时间线位置重新定锚，之后的期限按新速度计算
+  auto v = qMax(virt, virtNow());
+  if (hasPending) v = qMin(v, pendingVirt);
+  anchorVirt = v;
+  anchorWall = clock.nsecsElapsed();
+  anchorSpeed = qMax<qreal>(speed, 0.1);
+  paused = !playing;
+
+  if (paused) {
+    timer->stop();
+  } else {
+    step();
+  }
+}
+
+void Replayer::handleSeek() {
+  int secs = seekTarget.exchange(-1);
+  if (secs < 0) return;
+  // 界面收到 seekable_changed(false) 就不该再发跳转过来了，万一发了也要说一声
+  if (!snapshotSupported || start == 0) {
+    qWarning("replay seek ignored: %s",
+             start == 0 ? "playback not started" : "client snapshots unsupported");
+    emit ClientInstance->toast_message("Seeking is not available for this replay.");
+    return;
+  }
+
+  // 已经读出来还没执行的事件放回去
+  if (hasPending) {
+    reader.seek(pendingOffset);
+    hasPending = false;
+  }
+  if (!seekTo(start + secs * 1000ll)) {
+    qWarning("replay seek failed: no keyframe before %d s", secs);
+    emit ClientInstance->toast_message("Seeking is not available for this replay.");
+  }
+
+  virt = virtNow();
+  reschedule();
+}
+
+bool Replayer::fetchNext() {
+  ReplayReader::Event ev;
+  forever {
+    auto offset = reader.position();
+    if (!reader.next(ev)) return false;
+    if (ev.isRequest) continue;
+
+    qint64 delay = ev.elapsed - last;
     if (uniformRunning) {
       delay = qMin(delay, 2000);
       if (delay > 500)
@@ -187,23 +346,87 @@ void Replayer::run() {
     } else if (last == 0) {
       delay = 100;
     }
-    last = pair->elapsed;
+
+    pending = ev;
+    pendingOffset = offset;
+    pendingVirt = virt + delay;
+    hasPending = true;
+    return true;
+  }
+}
+
+void Replayer::step() {
+  while (!killed && !paused) {
+    if (!hasPending && !fetchNext()) {
+      // 播完了
+      quit();
+      return;
+    }
+
+    auto due = deadlineOf(pendingVirt);
+    auto now = clock.nsecsElapsed();
+    if (due > now) {
+      timer->start((due - now + 999999) / 1000000);
+      return;
+    }
+
+    maybeKeyframe(pending.elapsed, pendingOffset);
+    last = pending.elapsed;
+    virt = pendingVirt;
+    hasPending = false;
     if (start == 0) start = last;
 
-    bool delayed = true;
+    emit elasped((last - start) / 1000);
+    emit command_parsed(pending.cmd, ownBytes(pending.data));
 
-    if (!pair->isRequest) {
-      delay /= getSpeed();
+    // 排在 command_parsed 之后，执行时这个事件已经在主线程处理完了
+    QMetaObject::invokeMethod(this, [this, due]() {
+      auto late = qMax<qint64>(0, clock.nsecsElapsed() - due) / 1000;
+      driftCount++;
+      driftSum += late;
+      if (late > driftMax) driftMax = late;
+    }, Qt::QueuedConnection);
+  }
+}
 
-      msleep(delay);
-      emit elasped((pair->elapsed - start) / 1000);
+void Replayer::run() {
+  if (!reader.isValid() || reader.roomSettings.isEmpty()) {
+    emit ClientInstance->toast_message("Invalid replay file.");
+    deleteLater();
+    return;
+  }
 
-      emit command_parsed(pair->cmd, pair->jsonData);
+  if (reader.recordType == "normal") {
+    enterRoom();
+  }
 
-      if (!playing)
-        play_sem.acquire();
-    }
+  emit speed_changed(getSpeed());
+  emit seekable_changed(snapshotSupported);
+  if (reader.indexReady())
+    emit duration_set(getDuration());
+
+  // 事件按绝对时间线上的期限由定时器触发：处理事件花的时间不会累积成误差，
+  // 暂停只是停掉定时器，不占住线程
+  QObject context;
+  QTimer t;
+  t.setTimerType(Qt::PreciseTimer);
+  t.setSingleShot(true);
+  connect(&t, &QTimer::timeout, &context, [this]() { step(); });
+  timer = &t;
+  clock.start();
+  {
+    QMutexLocker locker(&schedulerLock);
+    scheduler = &context;
   }
 
+  QMetaObject::invokeMethod(&context, [this]() { reschedule(); }, Qt::QueuedConnection);
+  if (!killed)
+    exec();
+
+  {
+    QMutexLocker locker(&schedulerLock);
+    scheduler = nullptr;
+  }
+  timer = nullptr;
   deleteLater();
 }
@@ -3,21 +3,40 @@
 #ifndef _REPLAYER_H
 #define _REPLAYER_H
 
+#include "client/replay_reader.h"
+
 class Replayer : public QThread {
   Q_OBJECT
 
 public:
   explicit Replayer(QObject *parent, int id);
   explicit Replayer(QObject *parent, const QString &filename);
+  // raw 为录像文件/数据库中的原始数据
+  explicit Replayer(QObject *parent, const QByteArray &raw);
   ~Replayer();
 
+  struct VerifyResult {
+    bool valid = false;
+    int events = 0;
+    qint64 elapsed = 0;   // 毫秒
+    int luaErrors = 0;
+    QByteArray stateHash; // 最终客户端状态快照的哈希，Lua 不支持快照时为空
+  };
+  // 在调用线程上不加任何延迟地跑完整个录像，用于 --replay-verify
+  VerifyResult verify();
+
   int getDuration() const;
   qreal getSpeed();
+  // 事件实际在主线程执行完的时刻比时间线上的期限晚了多少：events/meanMs/maxMs
+  QVariantMap driftStats() const;
 
 signals:
   void duration_set(int secs);
   void elasped(int secs);
   void speed_changed(qreal speed);
+  // 能不能跳转：要 Lua 端提供 GetClientSnapshot/RestoreClientSnapshot，
+  // 不能的话界面应当隐藏进度条的拖动
+  void seekable_changed(bool seekable);
   void command_parsed(const QByteArray &cmd, const QByteArray &j);
 
 public slots:
@@ -26,31 +45,72 @@ public slots:
   void speedUp();
   void slowDown();
   void shutdown();
+  // 跳到第 secs 秒，由播放线程在处理下一个事件前执行；跳不了时弹出提示
+  void seek(int secs);
 
 protected:
   virtual void run();
 
 private:
   QString fileName;
-  qreal speed;
-  bool playing;
-  bool killed;
-  bool uniformRunning;
-  QByteArray roomSettings;
+  std::atomic<qreal> speed;
+  std::atomic_bool playing;
+  std::atomic_bool killed;
+  std::atomic_bool uniformRunning;
   QByteArray origPlayerInfo;
-  QByteArray recordType = "normal";
-  QMutex mutex;
-  QSemaphore play_sem;
 
-  struct Pair {
+  ReplayReader reader;
+  QFuture<void> indexing;
+  std::atomic_bool cancelIndex = false;
+
+  // 关键帧：offset 处的事件执行之前，Lua 端客户端状态的快照。
+  // 第一次播放（包括快进）经过时每隔 KeyframeInterval 记录一个，只在播放线程中使用
+  struct Keyframe {
     qint64 elapsed;
-    bool isRequest;
-    QByteArray cmd;
-    QByteArray jsonData;
+    quint32 offset;
+    QVariant state;
   };
-  QList<Pair *> pairs;
+  static constexpr qint64 KeyframeInterval = 30 * 1000;
+  QList<Keyframe> keyframes;
+  bool snapshotSupported = false;
+  std::atomic_int seekTarget = -1;
+  qint64 start = 0;
+
+  // 播放时间线。虚拟时间是按 uniform 等规则调整过间隔的录像时间，
+  // 事件的期限 = anchorWall + (事件虚拟时间 - anchorVirt) / anchorSpeed。
+  // 以下只在播放线程中使用，其他线程的操作通过 post() 排队过去
+  QObject *scheduler = nullptr;
+  QMutex schedulerLock;
+  QTimer *timer = nullptr;
+  QElapsedTimer clock;
+  qint64 anchorWall = 0; // 纳秒
+  qint64 anchorVirt = 0; // 毫秒
+  qreal anchorSpeed = 1.0;
+  bool paused = false;
+  qint64 last = 0;       // 上一个已执行事件的录像时间
+  qint64 virt = 0;       // 上一个已执行事件的虚拟时间
+  ReplayReader::Event pending;
+  bool hasPending = false;
+  quint32 pendingOffset = 0;
+  qint64 pendingVirt = 0;
+
+  // 漂移统计，微秒；只在主线程中写
+  std::atomic<qint64> driftCount = 0;
+  std::atomic<qint64> driftSum = 0;
+  std::atomic<qint64> driftMax = 0;
 
   void loadRawData(const QByteArray &raw);
+  void post(const std::function<void()> &func);
+  qint64 virtNow() const;
+  qint64 deadlineOf(qint64 v) const;
+  void reschedule();
+  void handleSeek();
+  bool fetchNext();
+  void step();
+  void enterRoom();
+  void maybeKeyframe(qint64 elapsed, quint32 offset);
+  // 跳不过去（没有可用的关键帧又不能从头重放）时返回 false
+  bool seekTo(qint64 target);
 };
 
 #endif // _REPLAYER_H
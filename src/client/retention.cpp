@@ -0,0 +1,133 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "client/retention.h"
+#include "core/c-wrapper.h"
+
+RecordingRetention::RecordingRetention(const QString &dbPath, QObject *parent)
+  : QObject(parent), dbPath(dbPath)
+{
+  // 单线程池：同一时刻只有一次清理在跑，也只用一条附加连接
+  pool.setMaxThreadCount(1);
+}
+
+RecordingRetention::~RecordingRetention() {
+  wait();
+}
+
+RecordingRetention::Limits RecordingRetention::limits() const {
+  QMutexLocker locker(&mutex);
+  return lim;
+}
+
+void RecordingRetention::setLimits(const Limits &limits) {
+  QMutexLocker locker(&mutex);
+  lim = limits;
+}
+
+void RecordingRetention::loadLimits(const QJsonObject &conf) {
+  auto obj = conf["recordingRetention"].toObject();
+  auto l = limits();
+  l.maxRecordings = obj["maxRecordings"].toInt(l.maxRecordings);
+  l.maxRoomData = obj["maxRoomData"].toInt(l.maxRoomData);
+  l.maxBytes = obj["maxBytes"].toInteger(l.maxBytes);
+  l.batchSize = qMax(1, obj["batchSize"].toInt(l.batchSize));
+  setLimits(l);
+}
+
+void RecordingRetention::schedule() {
+  // 已经排上队的话就不用再排了，那一次会看到最新的数据
+  if (pending.exchange(true))
+    return;
+
+  pool.start([this]() {
+    pending = false;
+    run();
+  });
+}
+
+void RecordingRetention::wait() {
+  pool.waitForDone();
+}
+
+void RecordingRetention::run() {
+  if (!db) {
+    db = std::make_unique<Sqlite3>(dbPath, QString());
+  }
+
+  auto l = limits();
+  qint64 bytes = l.maxBytes > 0 ? byteCutoff(l.maxBytes) : 0;
+
+  auto recCutoff = qMax(rowCutoff("myGameRecordings", l.maxRecordings), bytes);
+  auto roomCutoff = qMax(rowCutoff("myGameRoomData", l.maxRoomData), bytes);
+
+  int recs = cleanTable("myGameRecordings", "recording", recCutoff, l.batchSize);
+  int rooms = cleanTable("myGameRoomData", "room_data", roomCutoff, l.batchSize);
+
+  if (recs > 0 || rooms > 0) {
+    qInfo("Retention: removed %d recordings and %d room data", recs, rooms);
+    emit cleaned(recs, rooms);
+  }
+}
+
+qint64 RecordingRetention::watermark(const QString &table) {
+  auto ret = db->select(QString("SELECT value FROM clientMeta "
+                                "WHERE key = 'retention.%1';").arg(table));
+  return ret.isEmpty() ? 0 : ret[0]["value"].toLongLong();
+}
+
+// 收藏的对局，清理时跳过，也不占行数和大小的额度
+static const QString starred =
+  "SELECT id FROM starredRecording WHERE id IS NOT NULL";
+
+// 需要删除的最大id：不算收藏的，从新往旧数第 keep+1 行；没有那么多行就是0
+qint64 RecordingRetention::rowCutoff(const QString &table, int keep) {
+  if (keep <= 0) return 0;
+  auto ret = db->select(QString("SELECT id FROM %1 WHERE id NOT IN (%3) ORDER BY id DESC "
+                                "LIMIT 1 OFFSET %2;").arg(table).arg(keep).arg(starred));
+  return ret.isEmpty() ? 0 : ret[0]["id"].toLongLong();
+}
+
+// 从新往旧累加大小，第一个使总和超过上限的id及更旧的都要删
+qint64 RecordingRetention::byteCutoff(qint64 maxBytes) {
+  auto ret = db->select(QString(
+    "SELECT id FROM (SELECT id, SUM(recording + room_data) "
+    "OVER (ORDER BY id DESC) AS acc FROM myGameBlobSize WHERE id NOT IN (%2)) "
+    "WHERE acc > %1 ORDER BY id DESC LIMIT 1;").arg(maxBytes).arg(starred));
+  return ret.isEmpty() ? 0 : ret[0]["id"].toLongLong();
+}
+
+int RecordingRetention::cleanTable(const QString &table, const QString &sizeColumn,
+                                   qint64 cutoff, int batchSize) {
+  auto minRow = db->select(QString("SELECT min(id) AS m FROM %1;").arg(table));
+  if (minRow.isEmpty() || minRow[0]["m"] == "#null")
+    return 0;
+
+  // 水位线可能落后于表中最小id（例如从旧版本升级上来），直接跳过空档
+  auto lo = qMax(watermark(table), minRow[0]["m"].toLongLong() - 1);
+  int deleted = 0;
+
+  static auto sqlBatch = QString(
+    "BEGIN;"
+    "DELETE FROM %1 WHERE id > %2 AND id <= %3 AND id NOT IN (%5);"
+    "UPDATE myGameBlobSize SET %4 = 0 WHERE id > %2 AND id <= %3 AND id NOT IN (%5);"
+    "DELETE FROM myGameBlobSize WHERE id > %2 AND id <= %3 "
+    "AND recording = 0 AND room_data = 0;"
+    "INSERT INTO clientMeta (key, value) VALUES ('retention.%1', %3) "
+    "ON CONFLICT(key) DO UPDATE SET value = excluded.value;"
+    "COMMIT;");
+
+  while (lo < cutoff) {
+    auto hi = qMin(cutoff, lo + batchSize);
+    auto cnt = db->select(QString("SELECT count() AS c FROM %1 "
+                                  "WHERE id > %2 AND id <= %3 AND id NOT IN (%4);")
+                          .arg(table).arg(lo).arg(hi).arg(starred));
+    if (!db->exec(sqlBatch.arg(table).arg(lo).arg(hi).arg(sizeColumn, starred))) {
+      db->exec("ROLLBACK;");
+      break;
+    }
+    deleted += cnt.isEmpty() ? 0 : cnt[0]["c"].toInt();
+    lo = hi;
+  }
+
+  return deleted;
+}
@@ -0,0 +1,65 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _RETENTION_H
+#define _RETENTION_H
+
+class Sqlite3;
+
+/**
+  自动保存的录像（myGameRecordings）和复盘资料（myGameRoomData）的清理。
+
+  旧做法是在每次 INSERT 后由 trigger 执行 NOT IN 全表删除；现在改为在后台
+  线程上按 id 区间分批删除。每张表在 clientMeta 里记一个水位线，水位线以下
+  的行都已删掉，所以每次只需要删 (水位线, 截止id] 这一段，走的是主键范围。
+
+  截止 id 由两条规则取较大者：
+  - 行数：只保留最新的 maxRecordings / maxRoomData 行
+  - 字节：两张表的 blob 总大小不超过 maxBytes（0 表示不限）
+
+  starredRecording 中收藏的对局（id 不为 NULL 的）不删，也不计入行数和总大小；
+  水位线照样越过它们，所以取消收藏后这些行会一直留着，直到手动删除。
+  */
+class RecordingRetention : public QObject {
+  Q_OBJECT
+
+public:
+  struct Limits {
+    int maxRecordings = 5000;
+    int maxRoomData = 50000;
+    qint64 maxBytes = 0;
+    int batchSize = 500; // 每个事务最多删多少个id
+  };
+
+  RecordingRetention(const QString &dbPath, QObject *parent = nullptr);
+  ~RecordingRetention();
+
+  Limits limits() const;
+  void setLimits(const Limits &limits);
+  // 从 herokill.client.config.json 的 recordingRetention 字段读取限制
+  void loadLimits(const QJsonObject &conf);
+
+  // 请求一次清理；已有清理在跑时只会再补跑一次
+  void schedule();
+  // 等待正在进行的清理结束（析构、测试时用）
+  void wait();
+
+signals:
+  void cleaned(int recordings, int roomData);
+
+private:
+  QString dbPath;
+  std::unique_ptr<Sqlite3> db; // 只在工作线程中使用
+  QThreadPool pool;
+  mutable QMutex mutex;
+  Limits lim;
+  std::atomic_bool pending = false;
+
+  void run();
+  qint64 watermark(const QString &table);
+  qint64 rowCutoff(const QString &table, int keep);
+  qint64 byteCutoff(qint64 maxBytes);
+  int cleanTable(const QString &table, const QString &sizeColumn,
+                 qint64 cutoff, int batchSize);
+};
+
+#endif // _RETENTION_H
@@ -0,0 +1,122 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "client/spectator_buffer.h"
+
+SpectatorBuffer::SpectatorBuffer(QObject *parent) : QObject(parent) {
+  timer = new QTimer(this);
+  timer->setInterval(TickInterval);
+  connect(timer, &QTimer::timeout, this, &SpectatorBuffer::tick);
+  clock.start();
+}
+
+bool SpectatorBuffer::push(const QByteArray &command, const QByteArray &data, bool isRequest) {
+  if (command == "Observe") {
+    // Observe 带的是整个房间的快照，它本身马上执行，之后的事件进缓冲
+    stop();
+    start();
+    return false;
+  }
+  if (!active) return false;
+  if (isRequest || command == "EnterLobby" || command == "EnterRoom") {
+    stop();
+    return false;
+  }
+
+  queue.enqueue({ clock.elapsed(), command, data });
+  if (!timer->isActive()) {
+    lastTick = clock.elapsed();
+    timer->start();
+  }
+  return true;
+}
+
+int SpectatorBuffer::lag() const {
+  if (queue.isEmpty()) return 0;
+  return qMax<qint64>(0, clock.elapsed() - delayMs - queue.head().arrived);
+}
+
+void SpectatorBuffer::setDelay(int ms) {
+  ms = qBound(0, ms, 5 * 60 * 1000);
+  if (delayMs == ms) return;
+  delayMs = ms;
+  // 播放位置不能超过新的目标，否则加大延迟不起作用
+  playhead = qMin(playhead, clock.elapsed() - delayMs);
+  emit statusChanged();
+}
+
+void SpectatorBuffer::setCatchUpSpeed(qreal s) {
+  s = qBound<qreal>(1.0, s, 64.0);
+  if (speed == s) return;
+  speed = s;
+  emit statusChanged();
+}
+
+void SpectatorBuffer::skipToLive() {
+  playhead = clock.elapsed() - delayMs;
+  if (!queue.isEmpty() && !timer->isActive()) timer->start();
+}
+
+void SpectatorBuffer::start() {
+  active = true;
+  catchingUp = false;
+  playhead = clock.elapsed() - delayMs;
+  lastTick = clock.elapsed();
+  rateCount = 0;
+  rateStart = lastTick;
+  rate = 0;
+  emit statusChanged();
+}
+
+void SpectatorBuffer::stop() {
+  if (!active) return;
+  timer->stop();
+  while (!queue.isEmpty()) dispatch();
+  active = false;
+  catchingUp = false;
+  emit statusChanged();
+}
+
+void SpectatorBuffer::dispatch() {
+  auto p = queue.dequeue();
+  rateCount++;
+  emit command_ready(p.command, p.data);
+}
+
+void SpectatorBuffer::tick() {
+  auto now = clock.elapsed();
+  auto target = now - delayMs;
+  auto dt = now - lastTick;
+  lastTick = now;
+
+  if (queue.isEmpty()) {
+    playhead = target;
+    catchingUp = false;
+  } else {
+    // 落后太多就从队首开始按倍速推进（跳过中间没有事件的空白），追上了就跟着实时走。
+    // 主线程卡住之后的第一次 tick 的 dt 很大，不能一下子全部到期
+    catchingUp = target - queue.head().arrived > CatchUpThreshold;
+    if (catchingUp) {
+      playhead = qMax(playhead, queue.head().arrived);
+      playhead = qMin(target, playhead + qint64(qMin<qint64>(dt, 4 * TickInterval) * speed));
+    } else {
+      playhead = target;
+    }
+
+    QElapsedTimer slice;
+    slice.start();
+    while (!queue.isEmpty() && queue.head().arrived <= playhead && slice.elapsed() < SliceMs) {
+      dispatch();
+    }
+  }
+
+  if (now - rateStart >= 1000) {
+    rate = rateCount * 1000.0 / (now - rateStart);
+    rateCount = 0;
+    rateStart = now;
+  }
+  if (now - lastStatus >= StatusInterval) {
+    lastStatus = now;
+    emit statusChanged();
+  }
+  if (queue.isEmpty() && rate == 0) timer->stop();
+}
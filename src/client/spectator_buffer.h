@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _SPECTATOR_BUFFER_H
+#define _SPECTATOR_BUFFER_H
+
+/**
+  旁观时服务器事件的缓冲。
+
+  收到 Observe 之后，服务器发来的通知先进队列，再由定时器按到达时间交给 Lua：
+
+  - 播放位置落后实时（减去 delay）超过 CatchUpThreshold 时，按 catchUpSpeed
+    倍速推进，追上之后恢复原速；skipToLive() 直接跳到实时
+  - 每次定时器触发最多占用 SliceMs 的主线程时间，积压再多界面也不会卡死
+  - delay 可以让旁观画面固定晚于实际对局一段时间
+
+  request、回到大厅、进入别的房间时先把队列里剩下的全部执行完，然后停止缓冲。
+  */
+class SpectatorBuffer : public QObject {
+  Q_OBJECT
+  Q_PROPERTY(bool active READ isActive NOTIFY statusChanged)
+  Q_PROPERTY(int backlog READ backlog NOTIFY statusChanged)
+  Q_PROPERTY(int lag READ lag NOTIFY statusChanged)
+  Q_PROPERTY(qreal catchUpRate READ catchUpRate NOTIFY statusChanged)
+  Q_PROPERTY(bool catchingUp READ isCatchingUp NOTIFY statusChanged)
+  Q_PROPERTY(int delay READ delay WRITE setDelay NOTIFY statusChanged)
+  Q_PROPERTY(qreal catchUpSpeed READ catchUpSpeed WRITE setCatchUpSpeed NOTIFY statusChanged)
+
+public:
+  static constexpr int TickInterval = 16;       // 毫秒
+  static constexpr int SliceMs = 8;
+  static constexpr int CatchUpThreshold = 500;
+  static constexpr int StatusInterval = 200;
+
+  explicit SpectatorBuffer(QObject *parent = nullptr);
+
+  // 处理一条服务器消息；返回 false 表示没有缓冲，由调用方照常交给 Lua
+  bool push(const QByteArray &command, const QByteArray &data, bool isRequest);
+
+  bool isActive() const { return active; }
+  int backlog() const { return queue.size(); }
+  // 队首事件比应有的执行时刻晚了多少毫秒
+  int lag() const;
+  // 最近一秒每秒执行的事件数
+  qreal catchUpRate() const { return rate; }
+  bool isCatchingUp() const { return catchingUp; }
+  int delay() const { return delayMs; }
+  void setDelay(int ms);
+  qreal catchUpSpeed() const { return speed; }
+  void setCatchUpSpeed(qreal s);
+
+  Q_INVOKABLE void skipToLive();
+
+signals:
+  void command_ready(const QByteArray &command, const QByteArray &data);
+  void statusChanged();
+
+private:
+  struct Pending {
+    qint64 arrived; // clock 的毫秒数
+    QByteArray command;
+    QByteArray data;
+  };
+
+  QQueue<Pending> queue;
+  QTimer *timer;
+  QElapsedTimer clock;
+  bool active = false;
+  bool catchingUp = false;
+  int delayMs = 0;
+  qreal speed = 4.0;
+  qint64 playhead = 0;   // 已经放到的到达时间
+  qint64 lastTick = 0;
+  qint64 lastStatus = 0;
+  int rateCount = 0;
+  qint64 rateStart = 0;
+  qreal rate = 0;
+
+  void start();
+  void stop();
+  void tick();
+  void dispatch();
+};
+
+#endif // _SPECTATOR_BUFFER_H
@@ -2,6 +2,7 @@
 #include "network/client_socket.h"
 #include "network/router.h"
 #include "core/util.h"
+#include "core/manifest.h"
 #include "core/packman.h"
 #include "ui/qmlbackend.h"
 
@@ -190,18 +191,24 @@ void UpdateClient::onDownloadFinished(bool success, const QString &error)
 
 void UpdateClient::sendCheckUpdate()
 {
-    // 计算客户端 MD5
-    QString md5 = calcFileMD5();
+    setState(Checking);
 
-    // 构建 CheckUpdate 请求: [version, md5]
-    QCborArray body;
-    body.append(QString::fromLatin1(FK_VERSION));
-    body.append(md5);
+    // 客户端 MD5 启动时就在后台算了，这里等它算完再发，不占用界面线程
+    PackageManifest::login().then(this, [this](const PackageManifest::Login &login) {
+        if (m_state != Checking) {
+            return;
+        }
 
-    int type = Router::TYPE_NOTIFICATION | Router::SRC_CLIENT | Router::DEST_SERVER;
-    m_router->notify(type, "CheckUpdate", body.toCborValue().toCbor());
+        // 构建 CheckUpdate 请求: [version, md5, {格式名: 摘要}]
+        // 不认识第三项的旧服务器只看 md5
+        QCborArray body;
+        body.append(QString::fromLatin1(FK_VERSION));
+        body.append(login.md5);
+        body.append(login.formats);
 
-    setState(Checking);
+        int type = Router::TYPE_NOTIFICATION | Router::SRC_CLIENT | Router::DEST_SERVER;
+        m_router->notify(type, "CheckUpdate", body.toCborValue().toCbor());
+    });
 }
 
 void UpdateClient::handleNetworkDelayTest(const QByteArray &data)
@@ -245,7 +252,7 @@ void UpdateClient::handleUpdateInfo(const QByteArray &data)
         return;
     }
 
-    // 格式: [status, minVersion, maxVersion, packages, message, needRestart]
+    // 格式: [status, minVersion, maxVersion, packages, message, needRestart, manifestFormat?]
     // CBOR 可能将字符串编码为 byte string，需要特殊处理
     auto getStringValue = [](const QCborValue &val) -> QString {
         if (val.isString()) {
@@ -262,6 +269,9 @@ void UpdateClient::handleUpdateInfo(const QByteArray &data)
     m_updateInfo["maxVersion"] = getStringValue(arr[2]);
     m_updateInfo["message"] = getStringValue(arr[4]);
     m_updateInfo["needRestart"] = arr[5].toBool();
+    // 新服务器会告诉我们它按哪种清单格式核对的，旧服务器没有这一项
+    m_updateInfo["manifestFormat"] = arr.size() > 6 ? getStringValue(arr[6]) : QString("md5");
+    PackageManifest::setNegotiatedFormat(arr.size() > 6 ? getStringValue(arr[6]) : QString());
 
     // 解析包列表: [[name, url, hash], ...]
     QVariantList packages;
@@ -278,7 +288,8 @@ void UpdateClient::handleUpdateInfo(const QByteArray &data)
     }
     m_updateInfo["packages"] = packages;
 
-    qInfo() << "UpdateClient: 收到 UpdateInfo, status=" << status << ", packages=" << packages.length();
+    qInfo() << "UpdateClient: 收到 UpdateInfo, status=" << status << ", packages=" << packages.length()
+            << ", manifest=" << m_updateInfo["manifestFormat"].toString();
 
     emit updateInfoReceived(m_updateInfo);
 
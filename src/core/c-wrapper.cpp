@@ -46,6 +46,7 @@ bool Lua::dofile(const char *path) {
   if (error) {
     const char *error_msg = lua_tostring(L, -1);
     qCritical() << error_msg;
+    errors++;
     lua_pop(L, 2);
     return false;
   }
@@ -96,6 +97,7 @@ QVariant Lua::call(const QString &func_name, QVariantList params) {
   int err = lua_pcall(L, nargs, 1, -nargs - 2);
   if (err) {
     qCritical() << lua_tostring(L, -1);
+    errors++;
     lua_pop(L, 2);
     return QVariant();
   }
@@ -116,12 +118,14 @@ QVariant Lua::eval(const QString &lua) {
   err = luaL_loadstring(L, lua.toUtf8().constData());
   if (err != LUA_OK) {
     qCritical() << lua_tostring(L, -1);
+    errors++;
     lua_pop(L, 2);
     return QVariant();
   }
   err = lua_pcall(L, 0, 1, -2);
   if (err) {
     qCritical() << lua_tostring(L, -1);
+    errors++;
     lua_pop(L, 2);
     return QVariant();
   }
@@ -138,6 +142,16 @@ Sqlite3::Sqlite3(const QString &filename, const QString &initSql) {
 
   locker = std::make_unique<QLockFile>(filename + ".lock");
 
+  // 不带初始化脚本的是后台线程用的附加连接，表结构已由主连接建好
+  if (initSql.isEmpty()) {
+    rc = sqlite3_open(filename.toUtf8().data(), &db);
+    if (rc != SQLITE_OK) {
+      qCritical() << "Cannot open database:" << sqlite3_errmsg(db);
+    }
+    sqlite3_busy_timeout(db, 5000);
+    return;
+  }
+
   QFile file(initSql);
   if (!file.open(QIODevice::ReadOnly)) {
     qFatal("cannot open %s. Quit now.", initSql.toUtf8().data());
@@ -148,6 +162,7 @@ Sqlite3::Sqlite3(const QString &filename, const QString &initSql) {
   if (!QFile::exists(filename)) {
     char *err_msg;
     sqlite3_open(filename.toLatin1().data(), &db);
+    sqlite3_busy_timeout(db, 5000);
     rc = sqlite3_exec(db, in.readAll().toLatin1().data(), nullptr, nullptr,
                       &err_msg);
 
@@ -164,6 +179,8 @@ Sqlite3::Sqlite3(const QString &filename, const QString &initSql) {
       sqlite3_close(db);
       qApp->exit(1);
     }
+    // 后台维护线程也会写库，遇到锁时等一等而不是直接失败
+    sqlite3_busy_timeout(db, 5000);
 
     char *err_msg;
     rc = sqlite3_exec(db, in.readAll().toLatin1().data(), nullptr, nullptr,
@@ -198,14 +215,18 @@ static int callback(void *jsonDoc, int argc, char **argv, char **cols) {
 }
 
 Sqlite3::QueryResult Sqlite3::select(const QString &sql) {
-  static QMutex select_lock;
+  // 锁跟着连接走：后台维护连接上的慢查询不能卡住主连接
   QueryResult arr;
   char *err = NULL;
   auto bytes = sql.toUtf8();
   QMutexLocker locker(&select_lock);
-  sqlite3_exec(db, bytes.data(), callback, (void *)&arr, &err);
+  int rc = sqlite3_exec(db, bytes.data(), callback, (void *)&arr, &err);
   if (err) {
-    qCritical() << err;
+    // 被 interrupt() 或超出 setDeadline() 打断的属于正常情况，不弹窗
+    if (rc == SQLITE_INTERRUPT)
+      qInfo() << "sqlite:" << err;
+    else
+      qCritical() << err;
     sqlite3_free(err);
   }
   return arr;
@@ -224,18 +245,41 @@ QString Sqlite3::selectJson(const QString &sql) {
   return QJsonDocument(arr).toJson(QJsonDocument::Compact);
 }
 
-void Sqlite3::exec(const QString &sql) {
+bool Sqlite3::exec(const QString &sql) {
   // 写入时需要用到锁
   if (!locker->lock()) {
     qCritical("Cannot lock database lock file");
-    return;
+    return false;
   }
 
+  char *err = nullptr;
   auto bytes = sql.toUtf8();
-  sqlite3_exec(db, bytes.data(), nullptr, nullptr, nullptr);
+  int rc = sqlite3_exec(db, bytes.data(), nullptr, nullptr, &err);
+  if (err) {
+    qWarning() << "sqlite error:" << err;
+    sqlite3_free(err);
+  }
 
   // 怎么还要手动解锁 我locker_guard呢
   locker->unlock();
+  return rc == SQLITE_OK;
+}
+
+static int deadlineHandler(void *deadline) {
+  return ((QDeadlineTimer *)deadline)->hasExpired() ? 1 : 0;
+}
+
+void Sqlite3::setDeadline(const QDeadlineTimer &deadline) {
+  this->deadline = deadline;
+  if (deadline.isForever()) {
+    sqlite3_progress_handler(db, 0, nullptr, nullptr);
+  } else {
+    sqlite3_progress_handler(db, 1000, deadlineHandler, &this->deadline);
+  }
+}
+
+void Sqlite3::interrupt() {
+  sqlite3_interrupt(db);
 }
 
 quint64 Sqlite3::getMemUsage() {
@@ -27,8 +27,12 @@ public:
   QVariant call(const QString &func_name, QVariantList params = QVariantList());
   QVariant eval(const QString &lua);
 
+  // dofile/call/eval 出错的累计次数
+  int errorCount() const { return errors; }
+
 private:
   lua_State *L;
+  std::atomic_int errors = 0;
   QMutex interpreter_lock;
   QThread *current_thread = nullptr;
 
@@ -37,6 +41,7 @@ private:
 
 class Sqlite3 {
 public:
+  // initSql 为空时只打开连接、不执行建表脚本（给后台线程用）
   Sqlite3(const QString &filename = QStringLiteral("./server/users.db"),
           const QString &initSql = QStringLiteral("./server/init.sql"));
   Sqlite3(Sqlite3 &) = delete;
@@ -48,13 +53,20 @@ public:
   typedef QList<QMap<QString, QString>> QueryResult;
   QueryResult select(const QString &sql);
   QString selectJson(const QString &sql);
-  void exec(const QString &sql);
+  bool exec(const QString &sql);
+
+  // 超过期限的语句会被打断（返回 SQLITE_INTERRUPT），用于给后台维护限时
+  void setDeadline(const QDeadlineTimer &deadline);
+  // 打断这条连接上正在执行的语句，可以从别的线程调用
+  void interrupt();
 
   quint64 getMemUsage();
 
 private:
   sqlite3 *db;
   std::unique_ptr<QLockFile> locker;
+  QMutex select_lock;
+  QDeadlineTimer deadline = QDeadlineTimer(QDeadlineTimer::Forever);
 };
 
 #endif // _LUA_WRAPPER_H
@@ -0,0 +1,90 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "core/checkout_profile.h"
+#include "core/manifest.h"
+
+static const char *ProfileFile = "packages/.checkout-profile";
+
+static QMutex currentLock;
+static QString currentName;         // 空表示还没读过文件
+static CheckoutProfile *currentProfile = nullptr;
+
+QStringList CheckoutProfile::names() {
+  return { "full", "low-storage", "no-audio" };
+}
+
+QStringList CheckoutProfile::patterns(const QString &name) {
+  static const QStringList audio = { "audio", "*.wav", "*.mp3", "*.ogg" };
+  if (name == "no-audio") return audio;
+  if (name == "low-storage") {
+    // 语音 xxx.wav、xxx1.wav 留着，xxx2.wav 起的其他版本不要
+    return {
+      "*[2-9].wav", "*[2-9].mp3", "*[2-9].ogg",
+      "test", "tests", "*@2x.*", "*.psd",
+    };
+  }
+  return {};
+}
+
+CheckoutProfile::CheckoutProfile(const QString &name) {
+  profileName = names().contains(name) ? name : QStringLiteral("full");
+  auto list = patterns(profileName);
+  if (list.isEmpty()) return;
+
+  QList<QByteArray> bytes;
+  QList<char *> ptrs;
+  for (auto &p : list) bytes << p.toUtf8();
+  for (auto &b : bytes) ptrs << b.data();
+  git_strarray arr = { ptrs.data(), size_t(ptrs.size()) };
+  git_pathspec *ps = NULL;
+  if (git_pathspec_new(&ps, &arr) < 0) {
+    qCritical("Invalid checkout profile %s", qUtf8Printable(profileName));
+    return;
+  }
+  spec = QSharedPointer<git_pathspec>(ps, git_pathspec_free);
+}
+
+bool CheckoutProfile::excludes(const QString &path) const {
+  if (!spec || PackageManifest::kindOf(path) >= 0) return false;
+  return git_pathspec_matches_path(spec.data(), 0, path.toUtf8()) == 1;
+}
+
+QString CheckoutProfile::current() {
+  QMutexLocker locker(&currentLock);
+  if (currentName.isEmpty()) {
+    QFile f(ProfileFile);
+    currentName = f.open(QIODevice::ReadOnly) ? QString::fromUtf8(f.readAll()).trimmed() : "";
+    if (!names().contains(currentName)) currentName = "full";
+  }
+  return currentName;
+}
+
+bool CheckoutProfile::setCurrent(const QString &name) {
+  if (!names().contains(name)) return false;
+  QSaveFile f(ProfileFile);
+  if (!f.open(QIODevice::WriteOnly)) return false;
+  f.write(name.toUtf8());
+  if (!f.commit()) return false;
+
+  QMutexLocker locker(&currentLock);
+  currentName = name;
+  delete currentProfile;
+  currentProfile = nullptr;
+  return true;
+}
+
+bool CheckoutProfile::isExcludedAsset(const QString &path) {
+  auto name = current();
+  if (name == "full") return false;
+
+  // packages/<包名>/ 之后才是包里的路径
+  auto i = path.lastIndexOf("packages/");
+  if (i < 0) return false;
+  auto rest = path.mid(i + 9);
+  auto slash = rest.indexOf('/');
+  if (slash <= 0) return false;
+
+  QMutexLocker locker(&currentLock);
+  if (!currentProfile) currentProfile = new CheckoutProfile(name);
+  return currentProfile->excludes(rest.mid(slash + 1));
+}
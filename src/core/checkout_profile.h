@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _CHECKOUT_PROFILE_H
+#define _CHECKOUT_PROFILE_H
+
+#include <git2.h>
+
+/**
+  扩展包检出到工作区时要跳过哪些文件。
+
+  每个方案是一组相对于包根目录的 libgit2 pathspec（和 git 的一样，"audio"
+  匹配整个目录，"*" 可以跨目录）。内置的方案：
+
+  - full：全部检出
+  - no-audio：不要音频
+  - low-storage：语音只留前一两个版本，不要测试数据和高清图
+
+  lua、qml、js 文件无论如何都检出，登录时算的清单不受方案影响，和服务器的
+  一致。当前方案存在 packages/.checkout-profile，所有包共用。
+  */
+class CheckoutProfile {
+public:
+  explicit CheckoutProfile(const QString &name = current());
+
+  QString name() const { return profileName; }
+  bool isFull() const { return spec == nullptr; }
+  // path 相对于包根目录
+  bool excludes(const QString &path) const;
+
+  // 内置方案的名字和 pathspec
+  static QStringList names();
+  static QStringList patterns(const QString &name);
+
+  static QString current();
+  // 只记下来，已有的包要调用方重新检出
+  static bool setCurrent(const QString &name);
+
+  // 界面找资源用：path 是 packages/<包名>/... 或者含有这一段的绝对路径、url，
+  // 这个文件被当前方案跳过时返回 true
+  static bool isExcludedAsset(const QString &path);
+
+private:
+  QString profileName;
+  QSharedPointer<git_pathspec> spec;
+};
+
+#endif // _CHECKOUT_PROFILE_H
@@ -0,0 +1,114 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "core/download_progress.h"
+
+DownloadProgress::DownloadProgress(QObject *parent) : QObject(parent) {
+  timer = new QTimer(this);
+  timer->setInterval(1000 / rate);
+  connect(timer, &QTimer::timeout, this, &DownloadProgress::publish);
+  clock.start();
+}
+
+void DownloadProgress::update(const QString &pack, const git_indexer_progress &stats) {
+  QMutexLocker locker(&lock);
+  progressOf[pack] = stats;
+  running << pack;
+  dirty = true;
+  if (!scheduled) {
+    // 定时器只能在所属线程上启动
+    scheduled = true;
+    QMetaObject::invokeMethod(this, &DownloadProgress::wake, Qt::QueuedConnection);
+  }
+}
+
+void DownloadProgress::finish(const QString &pack) {
+  QMutexLocker locker(&lock);
+  if (running.remove(pack)) dirty = true;
+}
+
+void DownloadProgress::reset() {
+  QMutexLocker locker(&lock);
+  progressOf.clear();
+  running.clear();
+  dirty = true;
+  if (!scheduled) {
+    scheduled = true;
+    QMetaObject::invokeMethod(this, &DownloadProgress::wake, Qt::QueuedConnection);
+  }
+}
+
+void DownloadProgress::setMaxRate(int n) {
+  n = qBound(1, n, 60);
+  if (rate == n) return;
+  rate = n;
+  timer->setInterval(1000 / rate);
+  emit changed();
+}
+
+qreal DownloadProgress::progress() const {
+  if (sum.total_objects == 0) return 0;
+  return qreal(sum.received_objects) / sum.total_objects;
+}
+
+int DownloadProgress::eta() const {
+  if (sum.total_objects == 0 || sum.received_objects == 0 || speed < 1) return -1;
+  // 还没收到的部分按已收到对象的平均大小估算
+  qreal left = qreal(sum.received_bytes) / sum.received_objects
+    * (sum.total_objects - sum.received_objects);
+  return qCeil(left / speed);
+}
+
+void DownloadProgress::wake() {
+  if (timer->isActive()) return;
+  // 停了一阵又开始下载，速度从头算
+  lastTime = clock.elapsed();
+  lastBytes = -1;
+  publish();
+  timer->start();
+}
+
+void DownloadProgress::publish() {
+  git_indexer_progress total = {};
+  int active;
+  {
+    QMutexLocker locker(&lock);
+    if (!dirty) {
+      // 没有新进度：包都下完了就停下，下次 update() 再叫醒
+      if (running.isEmpty()) {
+        scheduled = false;
+        timer->stop();
+      }
+      return;
+    }
+    dirty = false;
+    for (auto &p : std::as_const(progressOf)) {
+      total.received_objects += p.received_objects;
+      total.total_objects += p.total_objects;
+      total.indexed_objects += p.indexed_objects;
+      total.received_bytes += p.received_bytes;
+      total.indexed_deltas += p.indexed_deltas;
+      total.total_deltas += p.total_deltas;
+    }
+    active = running.size();
+  }
+
+  auto now = clock.elapsed();
+  qint64 bytes = total.received_bytes;
+  if (lastBytes < 0 || bytes < lastBytes) {
+    // 刚开始或者重试之后重新计数
+    lastBytes = bytes;
+    lastTime = now;
+    if (active == 0) speed = 0;
+  } else if (now - lastTime >= 250) {
+    // 太短的间隔不算，数字跳得厉害
+    qreal current = (bytes - lastBytes) * 1000.0 / (now - lastTime);
+    speed = speed == 0 ? current : speed * 0.7 + current * 0.3;
+    lastBytes = bytes;
+    lastTime = now;
+  }
+  if (active == 0) speed = 0;
+
+  sum = total;
+  activePacks = active;
+  emit changed();
+}
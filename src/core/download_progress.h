@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _DOWNLOAD_PROGRESS_H
+#define _DOWNLOAD_PROGRESS_H
+
+#include <git2.h>
+
+/**
+  所有正在下载的扩展包合在一起的进度，给界面绑定属性用。
+
+  libgit2 的进度回调在各个下载线程上、每收到一点数据就来一次，update() 只是
+  记下各包最新的数字；属于的线程上的定时器每秒最多 maxRate 次把它们加起来、
+  算好速度和剩余时间，再发一次 changed()。没有新进度、也没有包在下载时
+  定时器停下。
+
+  一轮同步开始时 reset()，下完的包 finish() 之后数字仍然计入总数。
+  */
+class DownloadProgress : public QObject {
+  Q_OBJECT
+  Q_PROPERTY(bool active READ isActive NOTIFY changed)
+  Q_PROPERTY(int packages READ packages NOTIFY changed)
+  Q_PROPERTY(qint64 receivedObjects READ receivedObjects NOTIFY changed)
+  Q_PROPERTY(qint64 totalObjects READ totalObjects NOTIFY changed)
+  Q_PROPERTY(qint64 indexedObjects READ indexedObjects NOTIFY changed)
+  Q_PROPERTY(qint64 receivedBytes READ receivedBytes NOTIFY changed)
+  Q_PROPERTY(qreal progress READ progress NOTIFY changed)
+  Q_PROPERTY(qreal bytesPerSecond READ bytesPerSecond NOTIFY changed)
+  Q_PROPERTY(int eta READ eta NOTIFY changed)
+  Q_PROPERTY(int maxRate READ maxRate WRITE setMaxRate NOTIFY changed)
+
+public:
+  static constexpr int DefaultRate = 10;  // 每秒最多更新几次
+
+  explicit DownloadProgress(QObject *parent = nullptr);
+
+  // 以下三个可以在任意线程调用
+  void update(const QString &pack, const git_indexer_progress &stats);
+  void finish(const QString &pack);
+  void reset();
+
+  bool isActive() const { return activePacks > 0; }
+  // 正在下载的包数
+  int packages() const { return activePacks; }
+  qint64 receivedObjects() const { return sum.received_objects; }
+  qint64 totalObjects() const { return sum.total_objects; }
+  qint64 indexedObjects() const { return sum.indexed_objects; }
+  qint64 receivedBytes() const { return sum.received_bytes; }
+  // 0 到 1，收到的对象数占总数的比例
+  qreal progress() const;
+  // 最近一段时间的平均速度
+  qreal bytesPerSecond() const { return speed; }
+  // 预计还要多少秒，算不出来时是 -1
+  int eta() const;
+  // 最近一次发布的各项总和
+  git_indexer_progress totals() const { return sum; }
+  int maxRate() const { return rate; }
+  void setMaxRate(int n);
+
+signals:
+  void changed();
+
+private:
+  // 下载线程写，定时器读
+  QMutex lock;
+  QHash<QString, git_indexer_progress> progressOf;
+  QSet<QString> running;
+  bool dirty = false;
+  bool scheduled = false;
+
+  // 只在所属线程上用
+  QTimer *timer;
+  QElapsedTimer clock;
+  git_indexer_progress sum = {};
+  int activePacks = 0;
+  qreal speed = 0;
+  qint64 lastBytes = 0;
+  qint64 lastTime = 0;
+  int rate = DefaultRate;
+
+  void wake();
+  void publish();
+};
+
+#endif // _DOWNLOAD_PROGRESS_H
@@ -0,0 +1,321 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "core/manifest.h"
+#include "core/package_repo.h"
+#include <QtConcurrent>
+
+static const quint32 CacheMagic = 0x464b4d31; // "FKM1"
+// 修改时间离现在太近的文件，之后可能在同一毫秒内再被改掉，不进缓存
+static const qint64 RacyWindow = 2000;
+
+struct CachedHash {
+  qint64 size;
+  qint64 mtime;
+  QByteArray md5;
+};
+
+// 同一个缓存文件在进程里只读一次
+static QMutex cacheLock;
+static QString loadedCache;
+static QHash<QString, CachedHash> hashCache;
+
+static void loadCache(const QString &cacheFile) {
+  if (loadedCache == cacheFile) return;
+  loadedCache = cacheFile;
+  hashCache.clear();
+
+  QFile f(cacheFile);
+  if (!f.open(QIODevice::ReadOnly)) return;
+  QDataStream in(&f);
+  quint32 magic = 0;
+  qint64 count = 0;
+  in >> magic >> count;
+  if (magic != CacheMagic) return;
+  for (qint64 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+    QString path;
+    CachedHash h;
+    in >> path >> h.size >> h.mtime >> h.md5;
+    hashCache[path] = h;
+  }
+  if (in.status() != QDataStream::Ok) hashCache.clear();
+}
+
+static void saveCache(const QString &cacheFile) {
+  QSaveFile f(cacheFile);
+  if (!f.open(QIODevice::WriteOnly)) return;
+  QDataStream out(&f);
+  out << CacheMagic << qint64(hashCache.size());
+  for (auto it = hashCache.cbegin(); it != hashCache.cend(); it++) {
+    out << it.key() << it->size << it->mtime << it->md5;
+  }
+  f.commit();
+}
+
+// 参与清单的包目录
+static QFileInfoList packageDirs(const QString &root) {
+  static const QStringList builtinPkgs = {
+    "standard", "standard_cards","test",
+  };
+  QFileInfoList ret;
+  QDir d(root);
+  auto entries = d.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+  for (auto &info : entries) {
+    if (!info.isDir()) continue;
+    if (info.fileName().endsWith(".disabled")) continue;
+    if (builtinPkgs.contains(info.fileName())) continue;
+    ret << info;
+  }
+  return ret;
+}
+
+void PackageManifest::collect(const QString &dir, QList<Item> (&lists)[3]) {
+  // 和原来一样按名字排序，文件和子目录交错，不含隐藏文件
+  QDir d(dir);
+  auto entries = d.entryInfoList(
+      QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+  for (auto &info : entries) {
+    if (info.isDir()) {
+      collect(info.filePath(), lists);
+      continue;
+    }
+    int k = kindOf(info.fileName());
+    if (k < 0) continue;
+    lists[k] << Item { info.filePath(), info.size(),
+                       info.lastModified().toMSecsSinceEpoch(), QByteArray() };
+  }
+}
+
+int PackageManifest::kindOf(const QString &name) {
+  return name.endsWith(".lua") ? 0 : name.endsWith(".qml") ? 1 : name.endsWith(".js") ? 2 : -1;
+}
+
+QByteArray PackageManifest::hashFile(const QString &path) {
+  QFile f(path);
+  if (!f.open(QIODevice::ReadOnly)) {
+    return QByteArray();
+  }
+  auto data = f.readAll();
+  f.close();
+  // 没有 CRLF 的文件不用动
+  if (data.contains('\r')) data.replace(QByteArray("\r\n"), QByteArray("\n"));
+  return QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex();
+}
+
+QByteArray PackageManifest::build(const QString &root, const QString &cacheFile) {
+  QList<Item> lists[3]; // lua、qml、js
+  for (auto &info : packageDirs(root)) {
+    collect(info.filePath(), lists);
+  }
+
+  QMutexLocker locker(&cacheLock);
+  loadCache(cacheFile);
+
+  QList<Item *> stale;
+  QSet<QString> seen;
+  for (auto &list : lists) {
+    for (auto &item : list) {
+      seen << item.path;
+      auto it = hashCache.constFind(item.path);
+      if (it != hashCache.cend() && it->size == item.size && it->mtime == item.mtime) {
+        item.md5 = it->md5;
+      } else {
+        stale << &item;
+      }
+    }
+  }
+
+  bool dirty = false;
+  if (!stale.isEmpty()) {
+    QtConcurrent::blockingMap(stale, [](Item *item) {
+      item->md5 = hashFile(item->path);
+    });
+    auto now = QDateTime::currentMSecsSinceEpoch();
+    for (auto item : stale) {
+      if (item->md5.isEmpty() || item->mtime > now - RacyWindow) continue;
+      hashCache[item->path] = { item->size, item->mtime, item->md5 };
+      dirty = true;
+    }
+  }
+  // 已经删掉的文件
+  auto removed = hashCache.removeIf([&](QHash<QString, CachedHash>::iterator it) {
+    return !seen.contains(it.key());
+  });
+  if (removed > 0) dirty = true;
+  if (dirty) saveCache(cacheFile);
+
+  QByteArray ret;
+  for (auto &list : lists) {
+    for (auto &item : list) {
+      // 读不出来的文件以前也是直接跳过
+      if (item.md5.isEmpty()) continue;
+      ret += item.path.toUtf8() + '=' + item.md5 + ';';
+    }
+  }
+  return ret;
+}
+
+QString PackageManifest::md5(const QString &root, const QString &cacheFile) {
+  auto manifest = build(root, cacheFile);
+
+  // flist.txt 只留着排查问题用，内容变了才重写
+  static QMutex lastLock;
+  static QByteArray last;
+  {
+    QMutexLocker locker(&lastLock);
+    if (manifest != last) {
+      last = manifest;
+      QSaveFile flist("flist.txt");
+      if (flist.open(QIODevice::WriteOnly)) {
+        flist.write(manifest);
+        flist.commit();
+      } else {
+        qWarning("Cannot open flist.txt for writing.");
+      }
+    }
+  }
+
+  return QCryptographicHash::hash(manifest, QCryptographicHash::Md5).toHex();
+}
+
+QByteArray PackageManifest::blobId(const QString &path) {
+  QFile f(path);
+  if (!f.open(QIODevice::ReadOnly)) {
+    return QByteArray();
+  }
+  auto data = f.readAll();
+  git_oid oid;
+  if (git_odb_hash(&oid, data.constData(), data.size(), GIT_OBJECT_BLOB) < 0)
+    return QByteArray();
+  char buf[GIT_OID_HEXSZ + 1] = {0};
+  git_oid_tostr(buf, sizeof(buf), &oid);
+  return QByteArray(buf);
+}
+
+struct TreeWalk {
+  QString prefix;
+  QMap<QByteArray, QByteArray> *lists;
+};
+
+static int treeWalkCb(const char *root, const git_tree_entry *entry, void *payload) {
+  auto walk = static_cast<TreeWalk *>(payload);
+  if (git_tree_entry_type(entry) != GIT_OBJECT_BLOB) return 0;
+  auto name = QString::fromUtf8(git_tree_entry_name(entry));
+  int k = PackageManifest::kindOf(name);
+  if (k < 0) return 0;
+  char buf[GIT_OID_HEXSZ + 1] = {0};
+  git_oid_tostr(buf, sizeof(buf), git_tree_entry_id(entry));
+  walk->lists[k][(walk->prefix + QString::fromUtf8(root) + name).toUtf8()] = buf;
+  return 0;
+}
+
+QByteArray PackageManifest::buildFromGit(const QString &root) {
+  // 启动时 precompute() 比 PackMan 先跑，那时还没有人初始化过 libgit2；
+  // 这里自己持有一份（有引用计数，可以在任意线程调用）
+  git_libgit2_init();
+  QMap<QByteArray, QByteArray> lists[3];
+
+  for (auto &info : packageDirs(root)) {
+    auto prefix = info.filePath() + '/';
+    PackageRepo repo(info.filePath());
+    git_object *tree = NULL;
+    if (repo.open() < 0 ||
+        git_revparse_single(&tree, repo.repository(), "HEAD^{tree}") < 0) {
+      // 不是仓库，全部按内容算
+      QList<Item> items[3];
+      collect(info.filePath(), items);
+      for (int k = 0; k < 3; k++) {
+        auto ids = QtConcurrent::blockingMapped<QList<QByteArray>>(items[k],
+          [](const Item &item) { return blobId(item.path); });
+        for (int i = 0; i < ids.size(); i++) {
+          if (!ids[i].isEmpty()) lists[k][items[k][i].path.toUtf8()] = ids[i];
+        }
+      }
+      continue;
+    }
+
+    TreeWalk walk { prefix, lists };
+    git_tree_walk((git_tree *)tree, GIT_TREEWALK_PRE, treeWalkCb, &walk);
+    git_object_free(tree);
+
+    // 工作区的改动覆盖树里的内容
+    QStringList dirty;
+    repo.status(&dirty);
+    for (auto &rel : dirty) {
+      int k = kindOf(QFileInfo(rel).fileName());
+      if (k < 0) continue;
+      auto path = prefix + rel;
+      auto id = blobId(path);
+      if (id.isEmpty()) {
+        lists[k].remove(path.toUtf8());
+      } else {
+        lists[k][path.toUtf8()] = id;
+      }
+    }
+  }
+
+  QByteArray ret;
+  for (auto &list : lists) {
+    for (auto it = list.cbegin(); it != list.cend(); it++) {
+      ret += it.key() + '=' + it.value() + ';';
+    }
+  }
+  git_libgit2_shutdown();
+  return ret;
+}
+
+QString PackageManifest::gitDigest(const QString &root) {
+  return QCryptographicHash::hash(buildFromGit(root), QCryptographicHash::Md5).toHex();
+}
+
+QCborMap PackageManifest::formats() {
+  return QCborMap {
+    { "git-tree", gitDigest() },
+  };
+}
+
+static QMutex formatLock;
+static QString negotiated;
+
+QString PackageManifest::negotiatedFormat() {
+  QMutexLocker locker(&formatLock);
+  return negotiated;
+}
+
+void PackageManifest::setNegotiatedFormat(const QString &format) {
+  QMutexLocker locker(&formatLock);
+  negotiated = format;
+}
+
+static QMutex loginLock;
+static QFuture<PackageManifest::Login> loginFuture;
+static bool loginValid = false;
+
+// 调用时要持有 loginLock
+static void startLogin() {
+  loginValid = true;
+  loginFuture = QtConcurrent::run([]() {
+    QElapsedTimer timer;
+    timer.start();
+    PackageManifest::Login ret { PackageManifest::md5(), PackageManifest::formats() };
+    qInfo("Package manifest computed in %lld ms", timer.elapsed());
+    return ret;
+  });
+}
+
+void PackageManifest::precompute() {
+  QMutexLocker locker(&loginLock);
+  if (!loginValid) startLogin();
+}
+
+QFuture<PackageManifest::Login> PackageManifest::login() {
+  QMutexLocker locker(&loginLock);
+  if (!loginValid) startLogin();
+  return loginFuture;
+}
+
+void PackageManifest::invalidate() {
+  // 正在算的那次也作废：它可能已经读过了改动前的文件。拿到旧 future
+  // 的调用方仍然会得到旧结果，这和以前在改动前算的效果一样
+  QMutexLocker locker(&loginLock);
+  startLogin();
+}
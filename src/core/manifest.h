@@ -0,0 +1,72 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _MANIFEST_H
+#define _MANIFEST_H
+
+/**
+  扩展包代码文件的清单，登录和检查更新时把它的 md5 发给服务器比对。
+
+  清单和以前的 flist.txt 逐字节相同：依次列出 packages 下各包（跳过内置包和
+  .disabled）里所有 *.lua、*.qml、*.js 文件，每项是 "路径=md5;"，算 md5 之前
+  先把 CRLF 换成 LF。
+
+  - 目录只遍历一遍，三类文件同时收集
+  - 每个文件的 md5 按路径、大小、修改时间缓存，并存到 cacheFile，
+    没变过的文件不再读取
+  - 需要重新计算的文件在线程池里并行读取
+  */
+class PackageManifest {
+public:
+  static QByteArray build(const QString &root = QStringLiteral("packages"),
+                          const QString &cacheFile = QStringLiteral("flist.cache"));
+  // 清单的 md5，也就是 calcFileMD5() 的结果
+  static QString md5(const QString &root = QStringLiteral("packages"),
+                     const QString &cacheFile = QStringLiteral("flist.cache"));
+
+  /*
+    由 git 树得到的清单（格式名 "git-tree"），不用读文件内容。
+
+    同样跳过内置包和 .disabled，依次列出 lua、qml、js 三类文件，每类内按路径
+    的字节序排列，每项是 "路径=blob id;"。干净的仓库直接取 HEAD 树里的 blob id；
+    有改动或未跟踪的文件（忽略的不算）现场算 blob id，删掉的不列；不是 git
+    仓库的包整个按文件内容算。服务器用同样的规则遍历自己的仓库就能核对。
+    */
+  static QByteArray buildFromGit(const QString &root = QStringLiteral("packages"));
+  static QString gitDigest(const QString &root = QStringLiteral("packages"));
+
+  // 登录和检查更新时和旧的 md5 一起发给服务器的各种格式：格式名 -> 摘要
+  static QCborMap formats();
+  // 服务器在 UpdateInfo 里回复的、它用来核对的格式；旧服务器不回复，为空
+  static QString negotiatedFormat();
+  static void setNegotiatedFormat(const QString &format);
+
+  // 0、1、2 分别是 lua、qml、js，其余 -1
+  static int kindOf(const QString &name);
+
+  // 登录和检查更新要发给服务器的东西
+  struct Login {
+    QString md5;
+    QCborMap formats;
+  };
+
+  // 在后台预先计算 Login，启动时切换好工作目录就调用；已经开始了就什么也不做
+  static void precompute();
+  // 预先计算的结果，所有调用方共用一个；没有调用过 precompute() 的话现在开始算
+  static QFuture<Login> login();
+  // 扩展包有增删或更新，丢掉旧结果，在后台重新计算
+  static void invalidate();
+
+private:
+  struct Item {
+    QString path;
+    qint64 size;
+    qint64 mtime;
+    QByteArray md5;
+  };
+
+  static void collect(const QString &dir, QList<Item> (&lists)[3]);
+  static QByteArray hashFile(const QString &path);
+  static QByteArray blobId(const QString &path);
+};
+
+#endif // _MANIFEST_H
@@ -0,0 +1,384 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "core/object_store.h"
+
+// 从 packages/<包>/.git/objects 到共享库对象目录的相对路径，整个目录搬走也不会失效
+static const char *AlternatePath = "../../../.shared.git/objects";
+static const char *RefPrefix = "refs/fk/";
+static const char *SeedPrefix = "refs/fk-seed/";
+
+static int fail(const QString &what, int err) {
+  const git_error *e = git_error_last();
+  qCritical("Error %d/%d in %s: %s\n", err, e ? e->klass : 0, qUtf8Printable(what),
+            e ? e->message : "Unknown");
+  return err;
+}
+
+// 先列出名字再操作，免得一边遍历一边删
+static QStringList refNames(git_repository *repo, const char *glob) {
+  QStringList ret;
+  git_reference_iterator *it = NULL;
+  const char *name = NULL;
+  if (git_reference_iterator_glob_new(&it, repo, glob) < 0) return ret;
+  while (git_reference_next_name(&name, it) == 0) ret << QString::fromUtf8(name);
+  git_reference_iterator_free(it);
+  return ret;
+}
+
+static void deleteRefs(git_repository *repo, const QStringList &names) {
+  for (auto &name : names) {
+    git_reference *ref = NULL;
+    if (git_reference_lookup(&ref, repo, name.toUtf8()) == 0) git_reference_delete(ref);
+    git_reference_free(ref);
+  }
+}
+
+static bool hasLocalObjects(const QString &objectsDir) {
+  QDir dir(objectsDir);
+  for (auto &name : dir.entryList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+    if (name.size() == 2 && !QDir(dir.filePath(name)).isEmpty()) return true;
+  }
+  return !QDir(dir.filePath("pack")).entryList({ "*.pack" }, QDir::Files).isEmpty();
+}
+
+SharedObjectStore::SharedObjectStore(const QString &packagesDir) : packagesDir(packagesDir) {
+}
+
+QString SharedObjectStore::path() const {
+  return QDir(packagesDir).filePath(".shared.git");
+}
+
+QString SharedObjectStore::objectsPath() const {
+  return QDir(path()).filePath("objects");
+}
+
+bool SharedObjectStore::exists() const {
+  return QDir(objectsPath()).exists();
+}
+
+int SharedObjectStore::open(git_repository **out) {
+  if (exists()) return git_repository_open_bare(out, path().toUtf8());
+  return git_repository_init(out, path().toUtf8(), 1);
+}
+
+static QString alternatesFile(const QString &repoPath) {
+  return QDir(repoPath).filePath(".git/objects/info/alternates");
+}
+
+bool SharedObjectStore::isAttached(const QString &repoPath) const {
+  QFile f(alternatesFile(repoPath));
+  if (!f.open(QIODevice::ReadOnly)) return false;
+  for (auto &line : f.readAll().split('\n')) {
+    if (line.trimmed() == AlternatePath) return true;
+  }
+  return false;
+}
+
+bool SharedObjectStore::attach(const QString &repoPath) {
+  if (isAttached(repoPath)) return true;
+  if (!exists()) {
+    git_repository *shared = NULL;
+    if (open(&shared) < 0) {
+      fail(path(), -1);
+      return false;
+    }
+    git_repository_free(shared);
+  }
+  auto file = alternatesFile(repoPath);
+  QDir().mkpath(QFileInfo(file).path());
+  QFile f(file);
+  if (!f.open(QIODevice::Append)) return false;
+  f.write(QByteArray(AlternatePath) + '\n');
+  return true;
+}
+
+int SharedObjectStore::createRepository(git_repository **out, const char *path, int bare,
+                                        void *payload) {
+  auto store = static_cast<SharedObjectStore *>(payload);
+  int err = git_repository_init(out, path, bare);
+  if (err < 0) return err;
+
+  // 对象库在第一次用到时才加载，这时写好 alternates 就能生效
+  if (!store->attach(QString::fromUtf8(path))) return 0;
+  git_repository *shared = NULL;
+  if (git_repository_open_bare(&shared, store->path().toUtf8()) == 0) {
+    seed(*out, shared);
+    git_repository_free(shared);
+  }
+  return 0;
+}
+
+void SharedObjectStore::seed(git_repository *repo, git_repository *shared) {
+  // 协商时本地的引用都会作为 have 发给服务器
+  int n = 0;
+  for (auto &name : refNames(shared, "refs/fk/*")) {
+    git_oid oid;
+    if (git_reference_name_to_id(&oid, shared, name.toUtf8()) < 0) continue;
+    git_reference *created = NULL;
+    git_reference_create(&created, repo, QString("%1%2").arg(SeedPrefix).arg(n++).toUtf8(),
+                         &oid, 1, NULL);
+    git_reference_free(created);
+  }
+}
+
+void SharedObjectStore::dropSeeds(git_repository *repo) {
+  deleteRefs(repo, refNames(repo, "refs/fk-seed/*"));
+}
+
+qint64 SharedObjectStore::dirSize(const QString &dir) {
+  qint64 ret = 0;
+  QDirIterator it(dir, QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+  while (it.hasNext()) {
+    it.next();
+    ret += it.fileInfo().size();
+  }
+  return ret;
+}
+
+int SharedObjectStore::packCount(const QString &objectsDir) {
+  return QDir(QDir(objectsDir).filePath("pack")).entryList({ "*.pack" }, QDir::Files).size();
+}
+
+static int collectOid(const git_oid *id, void *payload) {
+  static_cast<QList<git_oid> *>(payload)->append(*id);
+  return 0;
+}
+
+int SharedObjectStore::absorb(const QString &name, const QString &repoPath) {
+  auto localDir = QDir(repoPath).filePath(".git/objects");
+
+  // 只看包自己的对象，不经过 alternates
+  git_odb *local = NULL;
+  git_odb_backend *packs = NULL, *loose = NULL;
+  QList<git_oid> oids;
+  int err = git_odb_new(&local);
+  if (err >= 0) err = git_odb_backend_pack(&packs, localDir.toUtf8());
+  if (err >= 0) err = git_odb_add_backend(local, packs, 2);
+  if (err >= 0) err = git_odb_backend_loose(&loose, localDir.toUtf8(), -1, 0, 0, 0);
+  if (err >= 0) err = git_odb_add_backend(local, loose, 1);
+  if (err >= 0) err = git_odb_foreach(local, collectOid, &oids);
+  git_odb_free(local);
+  if (err < 0) return fail(repoPath, err);
+
+  git_repository *shared = NULL;
+  git_odb *sharedOdb = NULL;
+  git_packbuilder *pb = NULL;
+  err = open(&shared);
+  if (err < 0) return fail(path(), err);
+  err = git_repository_odb(&sharedOdb, shared);
+
+  QList<git_oid> missing;
+  for (auto &oid : oids) {
+    if (err >= 0 && !git_odb_exists(sharedOdb, &oid)) missing << oid;
+  }
+
+  // 共享库里还没有的对象打成一个包写进去；打包时要能读到包里的对象
+  if (err >= 0 && !missing.isEmpty()) {
+    err = git_odb_add_disk_alternate(sharedOdb, QFileInfo(localDir).absoluteFilePath().toUtf8());
+    if (err >= 0) err = git_packbuilder_new(&pb, shared);
+    for (auto &oid : missing) {
+      if (err < 0) break;
+      err = git_packbuilder_insert(pb, &oid, NULL);
+    }
+    if (err >= 0) err = git_packbuilder_write(pb, NULL, 0, NULL, NULL);
+    git_packbuilder_free(pb);
+  }
+  git_odb_free(sharedOdb);
+  git_repository_free(shared);
+  if (err < 0) return fail(name, err);
+
+  // 重新打开核对一遍，全都在共享库里了才能删包里的
+  git_odb *check = NULL;
+  err = git_odb_open(&check, objectsPath().toUtf8());
+  if (err < 0) return fail(path(), err);
+  for (auto &oid : oids) {
+    if (!git_odb_exists(check, &oid)) {
+      git_odb_free(check);
+      qWarning() << "Shared object store is missing objects of" << name << ", keeping them";
+      return -1;
+    }
+  }
+  git_odb_free(check);
+
+  if (!attach(repoPath)) return -1;
+
+  QDir objects(localDir);
+  for (auto &info : objects.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+    if (info.fileName().size() == 2) QDir(info.filePath()).removeRecursively();
+  }
+  QDir pack(objects.filePath("pack"));
+  for (auto &file : pack.entryList({ "*.pack", "*.idx", "*.rev", "*.keep" }, QDir::Files)) {
+    pack.remove(file);
+  }
+  QFile::remove(objects.filePath("info/packs"));
+  return 0;
+}
+
+int SharedObjectStore::updateRefs(git_repository *shared, const QString &name,
+                                  const QString &repoPath) {
+  git_repository *repo = NULL;
+  int err = git_repository_open(&repo, repoPath.toUtf8());
+  if (err < 0) return fail(repoPath, err);
+
+  auto prefix = QString("%1%2/").arg(RefPrefix).arg(name);
+  QList<QPair<QString, git_oid>> refs;
+  git_oid oid;
+  if (git_reference_name_to_id(&oid, repo, "HEAD") == 0) {
+    refs << qMakePair(prefix + "HEAD", oid);
+  }
+  for (auto &refName : refNames(repo, "refs/*")) {
+    if (refName.startsWith(SeedPrefix)) continue;
+    if (git_reference_name_to_id(&oid, repo, refName.toUtf8()) == 0)
+      refs << qMakePair(prefix + refName.mid(5), oid);
+  }
+  git_repository_free(repo);
+
+  // 这些引用决定重新打包时保留哪些对象，有一个指向共享库里没有的对象就不动
+  git_odb *odb = NULL;
+  err = git_repository_odb(&odb, shared);
+  if (err < 0) return fail(path(), err);
+  for (auto &ref : refs) {
+    if (!git_odb_exists(odb, &ref.second)) {
+      git_odb_free(odb);
+      qWarning() << "Shared object store lacks" << ref.first << ", keeping old refs";
+      return -1;
+    }
+  }
+  git_odb_free(odb);
+
+  deleteRefs(shared, refNames(shared, (prefix + "*").toUtf8()));
+  for (auto &ref : refs) {
+    git_reference *created = NULL;
+    err = git_reference_create(&created, shared, ref.first.toUtf8(), &ref.second, 1, NULL);
+    git_reference_free(created);
+    if (err < 0) return fail(ref.first, err);
+  }
+  return 0;
+}
+
+int SharedObjectStore::repack(git_repository *shared) {
+  git_odb *odb = NULL;
+  git_packbuilder *pb = NULL;
+  QSet<QByteArray> visited;
+  QList<git_oid> queue;
+
+  int err = git_repository_odb(&odb, shared);
+  if (err >= 0) err = git_packbuilder_new(&pb, shared);
+  for (auto &name : refNames(shared, "refs/fk/*")) {
+    git_oid oid;
+    if (git_reference_name_to_id(&oid, shared, name.toUtf8()) == 0) queue << oid;
+  }
+
+  // 不用 revwalk：它遇到缺失的父提交就整个失败，这里只沿着库里有的父提交走，
+  // 少了对象也能把其余的打进包
+  while (err >= 0 && !queue.isEmpty()) {
+    auto oid = queue.takeLast();
+    auto key = QByteArray((const char *)oid.id, GIT_OID_RAWSZ);
+    if (visited.contains(key)) continue;
+    visited << key;
+
+    git_object *obj = NULL;
+    err = git_object_lookup(&obj, shared, &oid, GIT_OBJECT_ANY);
+    if (err < 0) break;
+    if (git_object_type(obj) == GIT_OBJECT_COMMIT) {
+      auto commit = (git_commit *)obj;
+      err = git_packbuilder_insert_commit(pb, &oid);
+      for (unsigned i = 0; err >= 0 && i < git_commit_parentcount(commit); i++) {
+        auto parent = git_commit_parent_id(commit, i);
+        if (git_odb_exists(odb, parent)) queue << *parent;
+      }
+    } else {
+      err = git_packbuilder_insert_recur(pb, &oid, NULL);
+    }
+    git_object_free(obj);
+  }
+
+  auto packDir = QDir(objectsPath()).filePath("pack");
+  auto old = QDir(packDir).entryList({ "*.pack", "*.idx", "*.rev" }, QDir::Files);
+  if (err >= 0) err = git_packbuilder_write(pb, NULL, 0, NULL, NULL);
+  QString packName = err >= 0 ? QString("pack-%1").arg(git_packbuilder_name(pb)) : QString();
+  git_packbuilder_free(pb);
+  git_odb_free(odb);
+  if (err < 0) return fail(path(), err);
+
+  // 新包写好了再删旧包和松散对象
+  for (auto &file : old) {
+    if (!file.startsWith(packName + '.')) QFile::remove(QDir(packDir).filePath(file));
+  }
+  QDir objects(objectsPath());
+  for (auto &info : objects.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+    if (info.fileName().size() == 2) QDir(info.filePath()).removeRecursively();
+  }
+  return 0;
+}
+
+QVariantMap SharedObjectStore::compact(const std::atomic_bool &cancel) {
+  QElapsedTimer timer;
+  timer.start();
+
+  QMap<QString, QString> repos; // 包名 -> 路径
+  QDir dir(packagesDir);
+  for (auto &info : dir.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name)) {
+    if (QDir(info.filePath()).exists(".git/objects")) repos[info.fileName()] = info.filePath();
+  }
+
+  qint64 before = dirSize(objectsPath());
+  for (auto &p : repos) before += dirSize(QDir(p).filePath(".git/objects"));
+
+  int absorbed = 0;
+  QSet<QString> failed;
+  for (auto it = repos.cbegin(); it != repos.cend() && !cancel; it++) {
+    // 已经挂上共享库、自己又没有新对象的包跳过
+    auto local = QDir(it.value()).filePath(".git/objects");
+    if (isAttached(it.value()) && !hasLocalObjects(local)) continue;
+    if (absorb(it.key(), it.value()) == 0) absorbed++; else failed << it.key();
+  }
+
+  bool repacked = false;
+  int removedPackages = 0;
+  git_repository *shared = NULL;
+  if (!cancel && exists() && open(&shared) == 0) {
+    // 已经删除的包的引用去掉，其余的按现状重建；这次没整理成功的包保留原来的引用
+    QStringList stale;
+    QSet<QString> removed;
+    for (auto &name : refNames(shared, "refs/fk/*")) {
+      auto pkg = name.mid(strlen(RefPrefix)).section('/', 0, 0);
+      if (!repos.contains(pkg)) {
+        stale << name;
+        removed << pkg;
+      }
+    }
+    deleteRefs(shared, stale);
+    removedPackages = removed.size();
+
+    bool refsOk = true;
+    for (auto it = repos.cbegin(); it != repos.cend(); it++) {
+      if (failed.contains(it.key()) || !isAttached(it.value())) continue;
+      if (updateRefs(shared, it.key(), it.value()) != 0) refsOk = false;
+    }
+
+    if (!cancel && refsOk && failed.isEmpty() &&
+        (removedPackages > 0 || packCount(objectsPath()) > RepackPacks)) {
+      repacked = repack(shared) == 0;
+    }
+    git_repository_free(shared);
+  }
+
+  qint64 after = dirSize(objectsPath());
+  for (auto &p : repos) after += dirSize(QDir(p).filePath(".git/objects"));
+
+  QVariantMap r;
+  r["packages"] = repos.size();
+  r["absorbed"] = absorbed;
+  r["failed"] = failed.size();
+  r["removedPackages"] = removedPackages;
+  r["repacked"] = repacked;
+  r["sharedSize"] = dirSize(objectsPath());
+  r["reclaimedSize"] = before - after;
+  r["elapsed"] = timer.elapsed();
+  qInfo("Shared object store: absorbed %d packages (%d failed), repacked %d, "
+        "reclaimed %lld bytes, shared store %lld bytes, %lld ms",
+        absorbed, (int)failed.size(), repacked, before - after, r["sharedSize"].toLongLong(),
+        r["elapsed"].toLongLong());
+  return r;
+}
@@ -0,0 +1,57 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _OBJECT_STORE_H
+#define _OBJECT_STORE_H
+
+#include <git2.h>
+
+/**
+  各个扩展包仓库共用的对象库（packages/.shared.git，裸仓库）。
+
+  每个包的 .git/objects/info/alternates 指向这里，整理时把包自己的对象搬进来、
+  删掉包里的副本，互相 fork 的包、.bak 恢复后重新克隆的包里相同的图片和音频
+  只存一份。共享库的 refs/fk/<包名>/... 记着各包的引用：
+
+  - 整理时按这些引用的可达性重新打包，已删除的包留下的对象随之清掉
+  - 新克隆的包先挂上 alternates，并临时带上这些引用，拉取时服务器知道哪些
+    对象本地已经有了
+
+  不是线程安全的，PackMan 保证同一时间只有一处在改包仓库。
+  */
+class SharedObjectStore {
+public:
+  // 共享库里的 pack 文件超过这个数目，或者有包被删掉了，才重新打包
+  static constexpr int RepackPacks = 8;
+
+  explicit SharedObjectStore(const QString &packagesDir = QStringLiteral("packages"));
+
+  QString path() const;
+  bool exists() const;
+
+  // 给仓库挂上共享库；已经挂上的什么都不做
+  bool attach(const QString &repoPath);
+  bool isAttached(const QString &repoPath) const;
+
+  // 作为 git_clone_options::repository_cb，payload 是 SharedObjectStore *
+  static int createRepository(git_repository **out, const char *path, int bare, void *payload);
+  // 克隆完成后去掉临时带上的引用
+  static void dropSeeds(git_repository *repo);
+
+  // 把 packagesDir 下各包自己的对象搬进共享库，清掉不再用到的对象。
+  // 返回整理的统计，cancel 为 true 时尽快停下
+  QVariantMap compact(const std::atomic_bool &cancel);
+
+private:
+  QString packagesDir;
+
+  int open(git_repository **out);
+  QString objectsPath() const;
+  int absorb(const QString &name, const QString &repoPath);
+  int updateRefs(git_repository *shared, const QString &name, const QString &repoPath);
+  int repack(git_repository *shared);
+  static void seed(git_repository *repo, git_repository *shared);
+  static qint64 dirSize(const QString &dir);
+  static int packCount(const QString &objectsDir);
+};
+
+#endif // _OBJECT_STORE_H
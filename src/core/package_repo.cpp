@@ -0,0 +1,362 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include "core/package_repo.h"
+#include <QtConcurrent>
+#ifdef Q_OS_UNIX
+#include <sys/stat.h>
+#endif
+
+static int fail(const QString &path, int err) {
+  const git_error *e = git_error_last();
+  qCritical("Error %d/%d in %s: %s\n", err, e ? e->klass : 0, qUtf8Printable(path),
+            e ? e->message : "Unknown");
+  return err;
+}
+
+PackageRepo::PackageRepo(const QString &path, const CheckoutProfile &profile)
+  : repoPath(path), profile(profile) {
+}
+
+PackageRepo::~PackageRepo() {
+  close();
+}
+
+int PackageRepo::open() {
+  if (repo) return 0;
+  int err = git_repository_open(&repo, repoPath.toUtf8());
+  if (err < 0) {
+    repo = nullptr;
+    // 判断目录是不是仓库时也会走到这里，不算错误
+    return err;
+  }
+  return 0;
+}
+
+void PackageRepo::close() {
+  git_remote_free(remote);
+  git_index_free(idx);
+  git_repository_free(repo);
+  remote = nullptr;
+  idx = nullptr;
+  repo = nullptr;
+}
+
+git_index *PackageRepo::index() {
+  if (!idx && repo && git_repository_index(&idx, repo) < 0) {
+    fail(repoPath, -1);
+    idx = nullptr;
+  }
+  return idx;
+}
+
+git_remote *PackageRepo::origin() {
+  if (!remote && repo && git_remote_lookup(&remote, repo, "origin") < 0) {
+    fail(repoPath, -1);
+    remote = nullptr;
+  }
+  return remote;
+}
+
+static const quint32 SnapshotMagic = 0x464b5331; // "FKS1"
+
+static bool statFile(const QString &path, qint64 &size, qint64 &mtime, quint64 &inode) {
+#if defined(Q_OS_UNIX)
+  struct stat st;
+  if (::stat(QFile::encodeName(path).constData(), &st) != 0) return false;
+  size = st.st_size;
+#if defined(Q_OS_DARWIN)
+  mtime = qint64(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+  mtime = qint64(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+  inode = st.st_ino;
+  return true;
+#else
+  QFileInfo info(path);
+  if (!info.exists()) return false;
+  size = info.size();
+  mtime = info.lastModified().toMSecsSinceEpoch() * 1000000;
+  inode = 0;
+  return true;
+#endif
+}
+
+// 遍历一个目录下的所有文件，路径相对于 root
+QList<QPair<QString, PackageRepo::FileStat>> PackageRepo::walk(const QString &root,
+                                                               const QString &dir) {
+  QList<QPair<QString, FileStat>> ret;
+  QDirIterator it(dir, QDir::Files | QDir::Hidden | QDir::System | QDir::NoDotAndDotDot,
+                  QDirIterator::Subdirectories);
+  QDir base(root);
+  while (it.hasNext()) {
+    auto path = it.next();
+    FileStat st;
+    if (statFile(path, st.size, st.mtime, st.inode))
+      ret << qMakePair(base.relativeFilePath(path), st);
+  }
+  return ret;
+}
+
+QString PackageRepo::snapshotPath() const {
+  return QDir(repoPath).filePath(".git/fk-stat-snapshot");
+}
+
+PackageRepo::StatMap PackageRepo::scanWorkdir() const {
+  // 顶层的每个目录一个任务并行遍历，.git 不算
+  QDir root(repoPath);
+  QStringList dirs;
+  StatMap ret;
+  for (auto &info : root.entryInfoList(QDir::AllEntries | QDir::Hidden | QDir::System |
+                                       QDir::NoDotAndDotDot)) {
+    if (info.fileName() == ".git") continue;
+    if (info.isDir() && !info.isSymLink()) {
+      dirs << info.absoluteFilePath();
+      continue;
+    }
+    FileStat st;
+    if (statFile(info.absoluteFilePath(), st.size, st.mtime, st.inode))
+      ret[info.fileName()] = st;
+  }
+
+  auto rootPath = root.absolutePath();
+  auto lists = QtConcurrent::blockingMapped<QList<QList<QPair<QString, FileStat>>>>(
+    dirs, [rootPath](const QString &dir) { return walk(rootPath, dir); });
+  for (auto &list : lists) {
+    for (auto &e : list) ret[e.first] = e.second;
+  }
+  return ret;
+}
+
+void PackageRepo::saveSnapshot() {
+  if (open() < 0) return;
+  auto files = scanWorkdir();
+
+  QSaveFile f(snapshotPath());
+  if (!f.open(QIODevice::WriteOnly)) return;
+  QDataStream out(&f);
+  // 写快照的时刻也记下，之后和它同时或更晚修改的文件一律复查
+  out << SnapshotMagic << head() << QDateTime::currentMSecsSinceEpoch() * 1000000
+      << qint64(files.size());
+  for (auto it = files.cbegin(); it != files.cend(); it++) {
+    out << it.key() << it->size << it->mtime << quint64(it->inode);
+  }
+  f.commit();
+}
+
+int PackageRepo::status(QStringList *dirty) {
+  int err = open();
+  if (err < 0) return fail(repoPath, err);
+
+  QFile f(snapshotPath());
+  if (!f.open(QIODevice::ReadOnly)) {
+    err = fullStatus({}, dirty);
+    if (err == 0) saveSnapshot();
+    return err;
+  }
+
+  QDataStream in(&f);
+  quint32 magic = 0;
+  QString snapHead;
+  qint64 snapTime = 0, count = 0;
+  in >> magic >> snapHead >> snapTime >> count;
+  if (magic != SnapshotMagic || snapHead != head() || in.status() != QDataStream::Ok) {
+    f.close();
+    err = fullStatus({}, dirty);
+    if (err == 0) saveSnapshot();
+    return err;
+  }
+
+  auto files = scanWorkdir();
+  QStringList changed;
+  for (qint64 i = 0; i < count && in.status() == QDataStream::Ok; i++) {
+    QString path;
+    FileStat old;
+    in >> path >> old.size >> old.mtime >> old.inode;
+    auto it = files.constFind(path);
+    if (it == files.cend()) {
+      changed << path; // 删掉了
+      continue;
+    }
+    // 和快照同一时刻前后改的文件 stat 可能看不出变化
+    if (it->size != old.size || it->mtime != old.mtime || it->inode != old.inode ||
+        it->mtime >= snapTime - 1000000000) {
+      changed << path;
+    }
+    files.erase(it);
+  }
+  f.close();
+  changed << files.keys(); // 新出现的
+
+  if (changed.isEmpty()) return 0;
+  err = fullStatus(changed, dirty);
+  // 只是 touch 过之类，内容没变，刷新快照免得下次再查
+  if (err == 0) saveSnapshot();
+  return err;
+}
+
+int PackageRepo::fullStatus(const QStringList &paths, QStringList *dirty) {
+  QList<QByteArray> bytes;
+  QList<char *> ptrs;
+  for (auto &p : paths) bytes << p.toUtf8();
+  for (auto &b : bytes) ptrs << b.data();
+
+  git_status_options opt = GIT_STATUS_OPTIONS_INIT;
+  opt.flags = GIT_STATUS_OPT_DEFAULTS;
+  if (!paths.isEmpty()) {
+    opt.pathspec = { ptrs.data(), size_t(ptrs.size()) };
+    opt.flags |= GIT_STATUS_OPT_DISABLE_PATHSPEC_MATCH;
+  }
+
+  git_status_list *list = NULL;
+  int err = git_status_list_new(&list, repo, &opt);
+  if (err < 0) return fail(repoPath, err);
+
+  auto n = git_status_list_entrycount(list);
+  for (size_t i = 0; i < n; i++) {
+    auto s = git_status_byindex(list, i);
+    if (s->status == GIT_STATUS_CURRENT || s->status == GIT_STATUS_IGNORED) continue;
+    auto delta = s->index_to_workdir ? s->index_to_workdir : s->head_to_index;
+    auto path = QString::fromUtf8(delta->new_file.path);
+    // 按方案没有检出的文件
+    if (s->status == GIT_STATUS_WT_DELETED && profile.excludes(path)) continue;
+    err = 100;
+    if (!dirty) break;
+    *dirty << path;
+  }
+  git_status_list_free(list);
+  if (err == 100) qCritical("Workspace is dirty.");
+  return err;
+}
+
+int PackageRepo::reset() {
+  int err = open();
+  if (err < 0) return fail(repoPath, err);
+  return checkoutHead();
+}
+
+struct ProfileWalk {
+  const CheckoutProfile *profile;
+  QSet<QString> wanted;
+  QStringList skipped;
+};
+
+static int profileWalkCb(const char *root, const git_tree_entry *entry, void *payload) {
+  if (git_tree_entry_type(entry) != GIT_OBJECT_BLOB) return 0;
+  auto walk = (ProfileWalk *)payload;
+  auto path = QString::fromUtf8(root) + QString::fromUtf8(git_tree_entry_name(entry));
+  if (walk->profile->excludes(path)) walk->skipped << path; else walk->wanted << path;
+  return 0;
+}
+
+int PackageRepo::checkoutHead() {
+  git_checkout_options opt = GIT_CHECKOUT_OPTIONS_INIT;
+  opt.checkout_strategy = GIT_CHECKOUT_FORCE;
+  if (profile.isFull()) {
+    int err = git_checkout_head(repo, &opt);
+    if (err < 0) return fail(repoPath, err);
+    saveSnapshot();
+    return 0;
+  }
+
+  git_object *tree = NULL;
+  int err = git_revparse_single(&tree, repo, "HEAD^{tree}");
+  if (err < 0) return fail(repoPath, err);
+  ProfileWalk walk { &profile, {}, {} };
+  git_tree_walk((git_tree *)tree, GIT_TREEWALK_PRE, profileWalkCb, &walk);
+
+  // 只检出不跳过的文件；索引里有、新树里没有的也要列上，不然删不掉
+  QStringList paths(walk.wanted.cbegin(), walk.wanted.cend());
+  if (index() && git_index_read(idx, 0) >= 0) {
+    auto n = git_index_entrycount(idx);
+    for (size_t i = 0; i < n; i++) {
+      auto path = QString::fromUtf8(git_index_get_byindex(idx, i)->path);
+      if (!walk.wanted.contains(path) && !profile.excludes(path)) paths << path;
+    }
+  }
+
+  QList<QByteArray> bytes;
+  QList<char *> ptrs;
+  for (auto &p : paths) bytes << p.toUtf8();
+  for (auto &b : bytes) ptrs << b.data();
+  opt.paths = { ptrs.data(), size_t(ptrs.size()) };
+  opt.checkout_strategy |= GIT_CHECKOUT_DISABLE_PATHSPEC_MATCH;
+  if (!paths.isEmpty()) err = git_checkout_head(repo, &opt);
+
+  if (err >= 0) {
+    // 换了方案的话工作区里还留着现在要跳过的文件
+    QDir dir(repoPath);
+    for (auto &p : walk.skipped) {
+      if (dir.remove(p)) dir.rmpath(QFileInfo(p).path());
+    }
+    // 索引和 HEAD 一致，跳过的文件在 status 里只是工作区删掉了
+    if (!index()) err = -1;
+    if (err >= 0) err = git_index_read_tree(idx, (git_tree *)tree);
+    if (err >= 0) err = git_index_write(idx);
+  }
+  git_object_free(tree);
+  if (err < 0) return fail(repoPath, err);
+  saveSnapshot();
+  return 0;
+}
+
+QString PackageRepo::head() {
+  git_oid oid;
+  if (open() < 0 || git_reference_name_to_id(&oid, repo, "HEAD") < 0) {
+    fail(repoPath, -1);
+    return QString("0000000000000000000000000000000000000000");
+  }
+  char buf[GIT_OID_HEXSZ + 1] = {0};
+  git_oid_tostr(buf, sizeof(buf), &oid);
+  return QString(buf);
+}
+
+int PackageRepo::hasCommit(const QString &hash) {
+  int err = open();
+  if (err < 0) return fail(repoPath, err);
+
+  git_oid oid;
+  git_commit *commit = NULL;
+  err = git_oid_fromstr(&oid, hash.toLatin1());
+  if (err < 0) return fail(repoPath, err);
+  // 找不到是常有的事，由调用方决定要不要去拉取，不打日志
+  err = git_commit_lookup(&commit, repo, &oid);
+  git_commit_free(commit);
+  return err;
+}
+
+bool PackageRepo::headContains(const QString &hash) {
+  git_oid given, headOid;
+  if (open() < 0 || hasCommit(hash) != 0) return false;
+  if (git_oid_fromstr(&given, hash.toLatin1()) < 0) return false;
+  if (git_reference_name_to_id(&headOid, repo, "HEAD") < 0) return false;
+  if (git_oid_equal(&given, &headOid)) return true;
+  return git_graph_descendant_of(repo, &headOid, &given) == 1;
+}
+
+int PackageRepo::fetch(const git_fetch_options *opt, const QStringList &refspecs) {
+  int err = open();
+  if (err < 0) return fail(repoPath, err);
+  if (!origin()) return -1;
+
+  QList<QByteArray> bytes;
+  QList<char *> ptrs;
+  for (auto &spec : refspecs) bytes << spec.toUtf8();
+  for (auto &b : bytes) ptrs << b.data();
+  git_strarray arr = { ptrs.data(), size_t(ptrs.size()) };
+
+  err = git_remote_fetch(remote, refspecs.isEmpty() ? NULL : &arr, opt, NULL);
+  if (err < 0) return fail(repoPath, err);
+  return 0;
+}
+
+int PackageRepo::checkout(const QString &hash) {
+  int err = open();
+  if (err < 0) return fail(repoPath, err);
+
+  git_oid oid;
+  err = git_oid_fromstr(&oid, hash.toLatin1());
+  if (err < 0) return fail(repoPath, err);
+  err = git_repository_set_head_detached(repo, &oid);
+  if (err < 0) return fail(repoPath, err);
+  return checkoutHead();
+}
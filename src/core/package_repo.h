@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#ifndef _PACKAGE_REPO_H
+#define _PACKAGE_REPO_H
+
+#include <git2.h>
+#include "core/checkout_profile.h"
+
+/**
+  一个扩展包仓库的会话。
+
+  仓库、索引和 origin 远端只打开一次，一轮更新里的 status、head、fetch、
+  checkout 都用同一组句柄，不再每一步都重新打开、重新读一遍仓库。
+
+  检出和重置都按 profile 跳过文件：索引和 HEAD 一致，跳过的文件只是不在工作区，
+  status 不把它们算作改动。
+
+  不是线程安全的，一个线程用自己的会话。返回 int 的函数都是 libgit2 的错误码，
+  失败时已经打过日志。
+  */
+class PackageRepo {
+public:
+  explicit PackageRepo(const QString &path, const CheckoutProfile &profile = CheckoutProfile());
+  PackageRepo(PackageRepo &) = delete;
+  PackageRepo(PackageRepo &&) = delete;
+  ~PackageRepo();
+
+  // 已经打开的直接返回 0
+  int open();
+  void close();
+  bool isOpen() const { return repo != nullptr; }
+  QString path() const { return repoPath; }
+
+  git_repository *repository() { return repo; }
+  git_index *index();
+  git_remote *origin();
+
+  // 0 表示干净，100 表示工作区有改动。有上次干净时的 stat 快照的话，
+  // 只对 stat 变了的文件问 libgit2。dirty 不为空时收集所有改动过的路径
+  // （相对于仓库，不含忽略的文件）
+  int status(QStringList *dirty = nullptr);
+  // 记下工作区每个文件的大小、修改时间和 inode，要在确认干净之后调用
+  void saveSnapshot();
+  // 丢掉工作区的改动，按 profile 重新检出
+  int reset();
+  // 读不到时返回全 0
+  QString head();
+  int hasCommit(const QString &hash);
+  // HEAD 就是 hash，或者是它的后代
+  bool headContains(const QString &hash);
+  // 从 origin 拉取，refspecs 为空时按远端的配置
+  int fetch(const git_fetch_options *opt, const QStringList &refspecs = {});
+  int checkout(const QString &hash);
+
+private:
+  struct FileStat {
+    qint64 size;
+    qint64 mtime;   // 纳秒
+    quint64 inode;
+  };
+  typedef QHash<QString, FileStat> StatMap;
+
+  QString repoPath;
+  CheckoutProfile profile;
+  git_repository *repo = nullptr;
+  git_index *idx = nullptr;
+  git_remote *remote = nullptr;
+
+  static QList<QPair<QString, FileStat>> walk(const QString &root, const QString &dir);
+  QString snapshotPath() const;
+  StatMap scanWorkdir() const;
+  int fullStatus(const QStringList &paths = {}, QStringList *dirty = nullptr);
+  int checkoutHead();
+};
+
+#endif // _PACKAGE_REPO_H
@@ -3,13 +3,38 @@
 #include <git2.h>
 #include <git2/errors.h>
 #include "core/packman.h"
+#include "core/package_repo.h"
+#include "core/manifest.h"
+#include "core/object_store.h"
+#include "core/checkout_profile.h"
 #include "ui/qmlbackend.h"
+#include <QtConcurrent>
 
 PackMan *Pacman = nullptr;
 
 PackMan::PackMan(QObject *parent) : QObject(parent) {
   git_libgit2_init();
   packagesJsonPath = "./packages/packages.json";
+  progress = new DownloadProgress(this);
+#ifndef FK_SERVER_ONLY
+  // 旧界面还在听这个事件，跟着属性一起限速发
+  connect(progress, &DownloadProgress::changed, this, [this]() {
+    if (Backend == nullptr || !progress->isActive()) return;
+    auto sum = progress->totals();
+    Backend->notifyUI("PackageTransferProgress", QJsonObject {
+      { "received_objects", qint64(sum.received_objects) },
+      { "total_objects", qint64(sum.total_objects) },
+      { "indexed_objects", qint64(sum.indexed_objects) },
+      { "received_bytes", qint64(sum.received_bytes) },
+      { "indexed_deltas", qint64(sum.indexed_deltas) },
+      { "total_deltas", qint64(sum.total_deltas) },
+    });
+  });
+#endif
+  setSyncWorkers(qEnvironmentVariableIntValue("FK_PACK_SYNC_WORKERS") > 0
+                 ? qEnvironmentVariableIntValue("FK_PACK_SYNC_WORKERS")
+                 : qMin(QThread::idealThreadCount(), 4));
+  setSharedObjects(qEnvironmentVariableIntValue("FK_PACK_SHARED_OBJECTS") > 0);
   loadPackagesJson();
 
 #ifdef Q_OS_ANDROID
@@ -18,6 +43,9 @@ PackMan::PackMan(QObject *parent) : QObject(parent) {
 }
 
 PackMan::~PackMan() {
+  // 后台整理对象库到一半也没关系，下次再来
+  cancelCompaction = true;
+  compaction.waitForFinished();
   git_libgit2_shutdown();
 }
 
@@ -111,6 +139,10 @@ void PackMan::disablePack(const QString &pack) {
 }
 
 void PackMan::removePack(const QString &pack) {
+  // 后台整理对象库时会读写各包的 .git，删之前先让它停下
+  cancelCompaction = true;
+  QMutexLocker locker(&repoLock);
+  cancelCompaction = false;
   for (int i = 0; i < packages.size(); i++) {
     auto obj = packages[i].toObject();
     if (obj["name"].toString() == pack) {
@@ -121,126 +153,198 @@ void PackMan::removePack(const QString &pack) {
   QDir d(QString("packages/%1").arg(pack));
   d.removeRecursively();
   savePackagesJson();
+  PackageManifest::invalidate();
 }
 
-void PackMan::loadSummary(const QString &jsonData, bool useThread) {
-  auto f = [=, this]() {
-    for (int i = 0; i < packages.size(); i++) {
-      auto obj = packages[i].toObject();
-      obj["enabled"] = false;
-      packages[i] = obj;
-      if (!disabled_packs.contains(obj["name"].toString()))
-        disabled_packs << obj["name"].toString();
-    }
+// 出错信息：100 是工作区脏，其余取 libgit2 这个线程上最后一个错误
+static QString gitErrorMessage(int err) {
+  if (err == 100) return "Workspace is dirty.";
+  auto error = git_error_last();
+  return QString("Error: %1").arg(error ? error->message : "Unknown");
+}
 
-    auto doc = QJsonDocument::fromJson(jsonData.toUtf8());
-    auto arr = doc.array();
-    for (auto e : arr) {
-      auto obj = e.toObject();
-      auto name = obj["name"].toString();
-      auto url = obj["url"].toString();
-      auto hash = obj["hash"].toString();
-      int err = 0;
+// 当前线程在处理的包，下载进度按它分开记
+static thread_local QString currentPack;
 
-#ifndef FK_SERVER_ONLY
-      Backend->notifyUI("SetDownloadingPackage", name);
-#endif
+PackMan::SyncResult PackMan::syncPack(const QJsonObject &obj) {
+  SyncResult r;
+  r.name = obj["name"].toString();
+  r.url = obj["url"].toString();
+  r.hash = obj["hash"].toString();
+  currentPack = r.name;
+  int err = 0;
 
-      QString packPath = QString("packages/%1").arg(name);
-      // If directory exists but is not a valid git repo, move it aside
-      // and re-clone. On clone failure, restore the backup so the client
-      // can still start next time.
-      if (QDir(packPath).exists()) {
-        git_repository *testRepo = NULL;
-        int openErr = git_repository_open(&testRepo, packPath.toUtf8());
-        git_repository_free(testRepo);
-        if (openErr < 0) {
-          QString backupPath = packPath + ".bak";
-          QDir(backupPath).removeRecursively();
-          qInfo() << "Directory exists but is not a valid git repo, re-cloning:" << name;
-          if (!QDir().rename(packPath, backupPath)) {
-            qCritical() << "Failed to rename" << packPath << "to backup";
-            continue;
-          }
-          err = clone(url);
-          if (err != 0) {
-            // Clone failed — clean up partial clone, then restore backup
-            qCritical() << "Clone failed, restoring backup for:" << name;
-            QDir(packPath).removeRecursively();
-            if (!QDir().rename(backupPath, packPath)) {
-              qCritical() << "CRITICAL: Failed to restore backup for:" << name
-                          << "from" << backupPath;
-#ifndef FK_SERVER_ONLY
-              Backend->notifyUI("PackageDownloadError",
-                QString("Failed to restore backup for %1").arg(name));
-#endif
-            }
 #ifndef FK_SERVER_ONLY
-            QString msg;
-            if (err != 100) {
-              auto error = git_error_last();
-              msg = QString("Error: %1").arg(error ? error->message : "Unknown");
-            } else {
-              msg = "Workspace is dirty.";
-            }
-            Backend->notifyUI("PackageDownloadError", msg);
+  Backend->notifyUI("SetDownloadingPackage", r.name);
 #endif
-            continue;
-          }
-          // Clone succeeded — remove the backup
-          QDir(backupPath).removeRecursively();
-        }
+
+  QString packPath = QString("packages/%1").arg(r.name);
+  // If directory exists but is not a valid git repo, move it aside
+  // and re-clone. On clone failure, restore the backup so the client
+  // can still start next time.
+  // 这一轮对这个包的所有操作都在同一个会话上
+  PackageRepo repo(packPath);
+  if (QDir(packPath).exists()) {
+    if (repo.open() < 0) {
+      QString backupPath = packPath + ".bak";
+      QDir(backupPath).removeRecursively();
+      qInfo() << "Directory exists but is not a valid git repo, re-cloning:" << r.name;
+      if (!QDir().rename(packPath, backupPath)) {
+        qCritical() << "Failed to rename" << packPath << "to backup";
+        r.error = QString("Failed to move aside %1").arg(r.name);
+        return r;
       }
-      if (!QDir(packPath).exists()) {
-        err = clone(url);
-        if (err != 0) {
+      err = clone(r.url);
+      if (err != 0) {
+        // Clone failed — clean up partial clone, then restore backup
+        r.error = gitErrorMessage(err);
+        r.retry = err != 100;
+        qCritical() << "Clone failed, restoring backup for:" << r.name;
+        QDir(packPath).removeRecursively();
+        if (!QDir().rename(backupPath, packPath)) {
+          qCritical() << "CRITICAL: Failed to restore backup for:" << r.name
+                      << "from" << backupPath;
 #ifndef FK_SERVER_ONLY
-          QString msg;
-          if (err != 100) {
-            auto error = git_error_last();
-            msg = QString("Error: %1").arg(error ? error->message : "Unknown");
-          } else {
-            msg = "Workspace is dirty.";
-          }
-          Backend->notifyUI("PackageDownloadError", msg);
+          Backend->notifyUI("PackageDownloadError",
+            QString("Failed to restore backup for %1").arg(r.name));
 #endif
-          continue;
         }
+        return r;
       }
+      // Clone succeeded — remove the backup
+      QDir(backupPath).removeRecursively();
+    }
+  }
+  if (!QDir(packPath).exists()) {
+    err = clone(r.url);
+    if (err != 0) {
+      r.error = gitErrorMessage(err);
+      r.retry = err != 100;
+      return r;
+    }
+  }
 
-      enablePack(name);
+  err = repo.open();
+  if (err < 0) {
+    r.error = gitErrorMessage(err);
+    return r;
+  }
+  r.enabled = true;
 
-      // 先检查工作区状态，如果脏就重置
-      err = status(name);
-      if (err == 100) {
-        qInfo() << "Workspace is dirty, resetting:" << name;
-        err = resetWorkspace(name);
-        if (err != 0) {
-          qCritical() << "Failed to reset workspace:" << name;
-        }
-      }
+  // 先检查工作区状态，如果脏就重置
+  err = repo.status();
+  if (err == 100) {
+    qInfo() << "Workspace is dirty, resetting:" << r.name;
+    err = repo.reset();
+    if (err != 0) {
+      qCritical() << "Failed to reset workspace:" << r.name;
+    }
+  }
 
-      if (head(name) != hash) {
-        err = updatePack(name, hash);
-        if (err != 0) {
-#ifndef FK_SERVER_ONLY
-          QString msg;
-          if (err != 100) {
-            auto error = git_error_last();
-            msg = QString("Error: %1").arg(error ? error->message : "Unknown");
-          } else {
-            msg = "Workspace is dirty.";
+  if (repo.head() != r.hash) {
+    err = updatePack(repo, r.hash);
+    if (err != 0) {
+      r.error = gitErrorMessage(err);
+      r.retry = err != 100;
+      return r;
+    }
+  }
+
+  r.updated = true;
+  return r;
+}
+
+void PackMan::setSyncWorkers(int n) {
+  syncWorkers = qBound(1, n, 16);
+}
+
+void PackMan::setSharedObjects(bool enabled) {
+  sharedObjects = enabled;
+}
+
+QVariantMap PackMan::compactObjects() {
+  QMutexLocker locker(&repoLock);
+  SharedObjectStore store;
+  auto report = store.compact(cancelCompaction);
+  emit objectsCompacted(report);
+  return report;
+}
+
+void PackMan::loadSummary(const QString &jsonData, bool useThread) {
+  auto f = [=, this]() {
+    // 上次同步后的整理还没做完就先停下，同步要紧
+    cancelCompaction = true;
+    QMutexLocker locker(&repoLock);
+    cancelCompaction = false;
+    for (int i = 0; i < packages.size(); i++) {
+      auto obj = packages[i].toObject();
+      obj["enabled"] = false;
+      packages[i] = obj;
+      if (!disabled_packs.contains(obj["name"].toString()))
+        disabled_packs << obj["name"].toString();
+    }
+
+    QList<QJsonObject> todo;
+    for (auto e : QJsonDocument::fromJson(jsonData.toUtf8()).array()) {
+      todo << e.toObject();
+    }
+    progress->reset();
+
+    // 每个包一个工作线程，互不影响；网络出错的包稍等片刻重来，
+    // 其余的包照常进行。packages 只在这个线程上改
+    QElapsedTimer wall;
+    wall.start();
+    QThreadPool pool;
+    pool.setMaxThreadCount(syncWorkers);
+    auto results = QtConcurrent::blockingMapped<QList<SyncResult>>(&pool, todo,
+      [this](const QJsonObject &obj) {
+        QElapsedTimer timer;
+        timer.start();
+        SyncResult r;
+        for (int attempt = 0; attempt <= SyncRetries; attempt++) {
+          if (attempt > 0) {
+            qInfo() << "Retrying package" << obj["name"].toString() << "attempt" << attempt;
+            QThread::msleep(1000 * attempt);
           }
-          Backend->notifyUI("PackageDownloadError", msg);
-#endif
-          continue;
+          r = syncPack(obj);
+          r.attempts = attempt + 1;
+          if (r.updated || !r.retry) break;
+        }
+        r.elapsed = timer.elapsed();
+        progress->finish(obj["name"].toString());
+#ifndef FK_SERVER_ONLY
+        if (!r.error.isEmpty()) {
+          Backend->notifyUI("PackageDownloadError", r.error);
         }
+#endif
+        return r;
+      });
+
+    int failed = 0;
+    qint64 serial = 0;
+    for (auto &r : results) {
+      serial += r.elapsed;
+      if (r.enabled) enablePack(r.name);
+      if (r.updated) {
+        updatePackageInJson(r.name, r.url, r.hash, true);
+      } else {
+        failed++;
+        qWarning() << "Failed to sync package" << r.name << "after" << r.attempts
+                   << "attempt(s):" << r.error;
       }
-
-      updatePackageInJson(name, url, hash, true);
     }
 
+    // packages.json 只在最后写一次
     savePackagesJson();
+    PackageManifest::invalidate();
+    // 逐个处理的耗时约等于各包耗时之和
+    qInfo("Synced %lld packages (%d failed) with %d workers in %lld ms, %lld ms serially",
+          (qint64)results.size(), failed, syncWorkers, wall.elapsed(), serial);
+
+    // 同步完了在后台把新下载的对象并入共享库，会等这里放开 repoLock
+    if (sharedObjects && !compaction.isRunning()) {
+      compaction = QtConcurrent::run([this]() { compactObjects(); });
+    }
   };
 
   if (useThread) {
@@ -257,57 +361,75 @@ void PackMan::loadSummary(const QString &jsonData, bool useThread) {
   }
 }
 
-int PackMan::updatePack(const QString &pack, const QString &hash) {
-  int err;
-  err = status(pack);
-  if (err == 100) {
-    // 工作区脏，自动重置
-    qInfo() << "Workspace is dirty, resetting:" << pack;
-    err = resetWorkspace(pack);
-    if (err != 0) {
-      qCritical() << "Failed to reset workspace:" << pack;
-      return err;
+QString PackMan::getCheckoutProfile() {
+  return CheckoutProfile::current();
+}
+
+void PackMan::setCheckoutProfile(const QString &name, bool useThread) {
+  auto f = [=, this]() {
+    cancelCompaction = true;
+    QMutexLocker locker(&repoLock);
+    cancelCompaction = false;
+    if (!CheckoutProfile::setCurrent(name)) {
+      qCritical("Cannot switch to checkout profile %s", qUtf8Printable(name));
+      return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QStringList repos;
+    for (auto &info : QDir("packages").entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+      if (QDir(info.filePath()).exists(".git")) repos << info.filePath();
     }
-  } else if (err != 0) {
-    return err;
+    // 已有的包全部按新方案重新检出，多出来的文件删掉，缺的补上
+    CheckoutProfile profile(name);
+    QThreadPool pool;
+    pool.setMaxThreadCount(syncWorkers);
+    QtConcurrent::blockingMap(&pool, repos, [&profile](const QString &path) {
+      PackageRepo(path, profile).reset();
+    });
+    PackageManifest::invalidate();
+    qInfo("Applied checkout profile %s to %lld packages in %lld ms", qUtf8Printable(name),
+          (qint64)repos.size(), timer.elapsed());
+  };
+
+  if (useThread) {
+    auto thread = QThread::create(f);
+    thread->start();
+    connect(thread, &QThread::finished, [=]() {
+      thread->deleteLater();
+#ifndef FK_SERVER_ONLY
+      Backend->notifyUI("CheckoutProfileApplied", name);
+#endif
+    });
+  } else {
+    f();
   }
+}
 
-  err = hasCommit(pack, hash);
+int PackMan::updatePack(PackageRepo &repo, const QString &hash) {
+  // 工作区在 syncPack 里已经检查并重置过
+  int err = repo.hasCommit(hash);
   if (err != 0) {
-    err = pull(pack);
-    if (err < 0)
-      return err;
+    // 先只取要求的这一个提交；服务端不给按哈希取的话，
+    // 再按 origin 的配置完整拉取
+    err = fetchCommit(repo, hash);
+    if (err < 0 || repo.hasCommit(hash) != 0) {
+      err = pull(repo);
+      if (err < 0)
+        return err;
+    }
   }
-  err = checkout(pack, hash);
-  if (err < 0)
-    return err;
-  return 0;
+  return repo.checkout(hash);
 }
 
 #define GIT_FAIL                                                               \
   const git_error *e = git_error_last();                                       \
   qCritical("Error %d/%d: %s\n", err, e ? e->klass : 0, e ? e->message : "Unknown")
 
-#define GIT_CHK_CLEAN  \
-  if (err < 0) {     \
-    GIT_FAIL;          \
-    goto clean;        \
-  }
-
 static int transfer_progress_cb(const git_indexer_progress *stats, void *payload) {
-  Q_UNUSED(payload);
-#ifndef FK_SERVER_ONLY
-  if (Backend != nullptr) {
-    Backend->notifyUI("PackageTransferProgress", QJsonObject {
-      { "received_objects", qint64(stats->received_objects) },
-      { "total_objects", qint64(stats->total_objects) },
-      { "indexed_objects", qint64(stats->indexed_objects) },
-      { "received_bytes", qint64(stats->received_bytes) },
-      { "indexed_deltas", qint64(stats->indexed_deltas) },
-      { "total_deltas", qint64(stats->total_deltas) },
-    });
-  }
-#endif
+  // 只记下来，由 DownloadProgress 限速汇总后再通知界面
+  static_cast<DownloadProgress *>(payload)->update(currentPack, *stats);
   return 0;
 }
 
@@ -326,205 +448,48 @@ int PackMan::clone(const QString &u) {
   git_clone_init_options(&opt, GIT_CLONE_OPTIONS_VERSION);
   opt.fetch_opts.proxy_opts.version = 1;
   opt.fetch_opts.callbacks.transfer_progress = transfer_progress_cb;
-  int err = git_clone(&repo, url.toUtf8(), fileName.toUtf8(), &opt);
-  if (err < 0) {
-    GIT_FAIL;
+  opt.fetch_opts.callbacks.payload = progress;
+  // 新仓库一开始就挂上共享对象库，已有的对象不再下载
+  SharedObjectStore store;
+  if (sharedObjects) {
+    opt.repository_cb = SharedObjectStore::createRepository;
+    opt.repository_cb_payload = &store;
   }
+  // 有检出方案的话克隆时先不检出，之后只检出方案要的文件
+  CheckoutProfile profile;
+  if (!profile.isFull())
+    opt.checkout_opts.checkout_strategy = GIT_CHECKOUT_NONE;
+  auto finish = [&]() {
+    SharedObjectStore::dropSeeds(repo);
+    git_repository_free(repo);
+    return profile.isFull() ? 0 : PackageRepo(fileName, profile).reset();
+  };
+  int err = git_clone(&repo, url.toUtf8(), fileName.toUtf8(), &opt);
+  if (err >= 0) return finish();
+  GIT_FAIL;
   git_repository_free(repo);
   return err;
 }
 
-int PackMan::pull(const QString &name) {
-  git_repository *repo = NULL;
-  int err;
-  git_remote *remote = NULL;
-  auto path = QString("packages/%1").arg(name).toUtf8();
+int PackMan::fetchCommit(PackageRepo &repo, const QString &hash) {
+  // 按哈希拉取（libgit2 1.5 起支持），服务端不允许的话由调用方退回完整拉取
   git_fetch_options opt;
   git_fetch_init_options(&opt, GIT_FETCH_OPTIONS_VERSION);
   opt.proxy_opts.version = 1;
   opt.callbacks.transfer_progress = transfer_progress_cb;
-
-  git_checkout_options opt2 = GIT_CHECKOUT_OPTIONS_INIT;
-  opt2.checkout_strategy = GIT_CHECKOUT_FORCE;
-
-  err = git_repository_open(&repo, path);
-  GIT_CHK_CLEAN;
-
-  err = git_remote_lookup(&remote, repo, "origin");
-  GIT_CHK_CLEAN;
-
-  err = git_remote_fetch(remote, NULL, &opt, NULL);
-  GIT_CHK_CLEAN;
-
-  err = git_repository_set_head(repo, "FETCH_HEAD");
-  GIT_CHK_CLEAN;
-
-  err = git_checkout_head(repo, &opt2);
-  GIT_CHK_CLEAN;
-
-clean:
-  git_remote_free(remote);
-  git_repository_free(repo);
-  return err;
-}
-
-int PackMan::hasCommit(const QString &name, const QString &hash) {
-  git_repository *repo = NULL;
-  int err;
-  git_oid oid = {0};
-  git_commit *commit = NULL;
-
-  auto path = QString("packages/%1").arg(name).toUtf8();
-  auto sha = hash.toLatin1();
-  err = git_repository_open(&repo, path);
-  GIT_CHK_CLEAN;
-  err = git_oid_fromstr(&oid, sha);
-  GIT_CHK_CLEAN;
-  err = git_commit_lookup(&commit, repo, &oid);
-
-clean:
-  git_commit_free(commit);
-  git_repository_free(repo);
-  return err;
-}
-
-int PackMan::checkout(const QString &name, const QString &hash) {
-  git_repository *repo = NULL;
-  int err;
-  git_oid oid = {0};
-  git_checkout_options opt = GIT_CHECKOUT_OPTIONS_INIT;
-  opt.checkout_strategy = GIT_CHECKOUT_FORCE;
-  auto path = QString("packages/%1").arg(name).toUtf8();
-  auto sha = hash.toLatin1();
-  err = git_repository_open(&repo, path);
-  GIT_CHK_CLEAN;
-  err = git_oid_fromstr(&oid, sha);
-  GIT_CHK_CLEAN;
-  err = git_repository_set_head_detached(repo, &oid);
-  GIT_CHK_CLEAN;
-  err = git_checkout_head(repo, &opt);
-  GIT_CHK_CLEAN;
-
-clean:
-  git_repository_free(repo);
-  return err;
-}
-
-int PackMan::resetWorkspace(const QString &name) {
-  git_repository *repo = NULL;
-  int err;
-  git_checkout_options opt = GIT_CHECKOUT_OPTIONS_INIT;
-  opt.checkout_strategy = GIT_CHECKOUT_FORCE;
-  auto path = QString("packages/%1").arg(name).toUtf8();
-
-  err = git_repository_open(&repo, path);
-  GIT_CHK_CLEAN;
-
-  err = git_checkout_head(repo, &opt);
-  GIT_CHK_CLEAN;
-
-clean:
-  git_repository_free(repo);
-  return err;
-}
-
-int PackMan::status(const QString &name) {
-  git_repository *repo = NULL;
-  int err;
-  git_status_list *status_list = NULL;
-  size_t i, maxi;
-  const git_status_entry *s;
-  auto path = QString("packages/%1").arg(name).toUtf8();
-  err = git_repository_open(&repo, path);
-  GIT_CHK_CLEAN;
-  err = git_status_list_new(&status_list, repo, NULL);
-  GIT_CHK_CLEAN;
-  maxi = git_status_list_entrycount(status_list);
-  for (i = 0; i < maxi; ++i) {
-    s = git_status_byindex(status_list, i);
-    if (s->status != GIT_STATUS_CURRENT && s->status != GIT_STATUS_IGNORED) {
-      git_status_list_free(status_list);
-      git_repository_free(repo);
-      qCritical("Workspace is dirty.");
-      return 100;
-    }
-  }
-
-clean:
-  git_status_list_free(status_list);
-  git_repository_free(repo);
-  return err;
+  opt.callbacks.payload = progress;
+  opt.download_tags = GIT_REMOTE_DOWNLOAD_TAGS_NONE;
+  return repo.fetch(&opt, { hash });
 }
 
-QString PackMan::head(const QString &name) {
-  git_repository *repo = NULL;
-  int err;
-  git_object *obj = NULL;
-  const git_oid *oid;
-  char buf[42] = {0};
-  auto path = QString("packages/%1").arg(name).toUtf8();
-  err = git_repository_open(&repo, path);
-  GIT_CHK_CLEAN;
-  err = git_revparse_single(&obj, repo, "HEAD");
-  GIT_CHK_CLEAN;
-
-  oid = git_object_id(obj);
-  git_oid_tostr(buf, 41, oid);
-  git_object_free(obj);
-  git_repository_free(repo);
-  return QString(buf);
-
-clean:
-  git_object_free(obj);
-  git_repository_free(repo);
-  return QString("0000000000000000000000000000000000000000");
-}
-
-static bool is_head_newer_than_commit(const char *repo_path, const char *commit_hash) {
-  git_repository *repo = NULL;
-  git_commit *given_commit = NULL;
-  git_commit *head_commit = NULL;
-  bool result = false;
-
-  git_libgit2_init();
-
-  if (git_repository_open(&repo, repo_path) != 0) {
-    goto cleanup;
-  }
-
-  git_oid given_oid;
-  if (git_oid_fromstr(&given_oid, commit_hash) != 0) {
-    goto cleanup;
-  }
-
-  if (git_commit_lookup(&given_commit, repo, &given_oid) != 0) {
-    goto cleanup;
-  }
-
-  git_oid head_oid;
-  if (git_reference_name_to_id(&head_oid, repo, "HEAD") != 0) {
-    goto cleanup;
-  }
-
-  if (git_commit_lookup(&head_commit, repo, &head_oid) != 0) {
-    goto cleanup;
-  }
-
-  if (git_graph_descendant_of(repo, &head_oid, &given_oid) == 1) {
-    result = true;
-  }
-
-  if (strncmp((char*)head_oid.id, (char*)given_oid.id, 20) == 0) {
-    result = true;
-  }
-
-cleanup:
-  git_commit_free(given_commit);
-  git_commit_free(head_commit);
-  git_repository_free(repo);
-  git_libgit2_shutdown();
-
-  return result;
+int PackMan::pull(PackageRepo &repo) {
+  git_fetch_options opt;
+  git_fetch_init_options(&opt, GIT_FETCH_OPTIONS_VERSION);
+  opt.proxy_opts.version = 1;
+  opt.callbacks.transfer_progress = transfer_progress_cb;
+  opt.callbacks.payload = progress;
+  // 拉取之后马上会 checkout 到指定的提交，不用再切到 FETCH_HEAD
+  return repo.fetch(&opt);
 }
 
 static const char *min_commit = "b57d89fa4c1a1ae5a0711b97598747b8cbc7428e";
@@ -532,9 +497,8 @@ static const char *min_commit = "b57d89fa4c1a1ae5a0711b97598747b8cbc7428e";
 bool PackMan::shouldUseCore() {
   if (!QFile::exists("packages/herokill-core")) return false;
   if (disabled_packs.contains("herokill-core")) return false;
-  bool ret = is_head_newer_than_commit("packages/herokill-core", min_commit);
-  return ret;
+  PackageRepo repo("packages/herokill-core");
+  return repo.headContains(min_commit);
 }
 
 #undef GIT_FAIL
-#undef GIT_CHK_CLEAN
@@ -3,8 +3,14 @@
 #ifndef _PACKMAN_H
 #define _PACKMAN_H
 
+#include "core/download_progress.h"
+
+class PackageRepo;
+
 class PackMan : public QObject {
   Q_OBJECT
+  // 所有包的下载进度合在一起，QML 里绑定 Pacman.progress 的属性
+  Q_PROPERTY(DownloadProgress *progress READ downloadProgress CONSTANT)
 
 public:
   PackMan(QObject *parent = nullptr);
@@ -14,18 +20,46 @@ public:
   Q_INVOKABLE QStringList getDisabledPacks();
   Q_INVOKABLE void loadSummary(const QString &jsonData, bool useThread = false);
   Q_INVOKABLE void removePack(const QString &pack);
+  // 检出方案：full、low-storage、no-audio，见 CheckoutProfile
+  Q_INVOKABLE QString getCheckoutProfile();
+  // 记下新方案并按它重新检出所有已安装的包
+  Q_INVOKABLE void setCheckoutProfile(const QString &name, bool useThread = false);
 
   bool shouldUseCore();
+  DownloadProgress *downloadProgress() const { return progress; }
+  // loadSummary 同时同步的包数，设为 1 就是逐个同步
+  void setSyncWorkers(int n);
+  // 各包共用 packages/.shared.git 里的对象，同步之后在后台整理。开启后
+  // 各包自己的对象会被删掉，没法再退回去，所以默认关闭，要设环境变量
+  // FK_PACK_SHARED_OBJECTS=1 才开启
+  void setSharedObjects(bool enabled);
+  // 把各包的对象并入共享库并清理，返回的统计同时通过 objectsCompacted 发出
+  QVariantMap compactObjects();
+
+signals:
+  void objectsCompacted(const QVariantMap &report);
 
 private:
+  static constexpr int SyncRetries = 2;
+
+  // 单个包的同步结果，汇总后再改 packages
+  struct SyncResult {
+    QString name;
+    QString url;
+    QString hash;
+    bool enabled = false;   // 本地已有可用的仓库
+    bool updated = false;   // 已经切到了要求的提交
+    bool retry = false;     // 网络之类的错误，可以重试
+    int attempts = 0;
+    qint64 elapsed = 0;
+    QString error;
+  };
+
+  SyncResult syncPack(const QJsonObject &pkg);
   int clone(const QString &url);
-  int pull(const QString &name);
-  int updatePack(const QString &pack, const QString &hash);
-  int checkout(const QString &name, const QString &hash);
-  int resetWorkspace(const QString &name);
-  int hasCommit(const QString &name, const QString &hash);
-  int status(const QString &name);
-  QString head(const QString &name);
+  int pull(PackageRepo &repo);
+  int fetchCommit(PackageRepo &repo, const QString &hash);
+  int updatePack(PackageRepo &repo, const QString &hash);
 
   void loadPackagesJson();
   void savePackagesJson();
@@ -37,6 +71,13 @@ private:
   QJsonArray packages;
   QStringList disabled_packs;
   QString packagesJsonPath;
+  DownloadProgress *progress;
+  int syncWorkers = 1;
+  bool sharedObjects = false;
+  // 同步和整理对象库不能同时进行
+  QMutex repoLock;
+  QFuture<void> compaction;
+  std::atomic_bool cancelCompaction = false;
 };
 
 extern PackMan *Pacman;
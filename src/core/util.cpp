@@ -1,78 +1,12 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "core/util.h"
+#include "core/manifest.h"
 #include <QSysInfo>
 #include <git2.h>
 
-static void writeFileMD5(QFile &dest, const QString &fname) {
-  QFile f(fname);
-  if (!f.open(QIODevice::ReadOnly)) {
-    return;
-  }
-
-  auto data = f.readAll();
-  f.close();
-  data.replace(QByteArray("\r\n"), QByteArray("\n"));
-  auto hash = QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex();
-  dest.write(fname.toUtf8() + '=' + hash + ';');
-}
-
-static void writeDirMD5(QFile &dest, const QString &dir,
-                        const QString &filter) {
-  QDir d(dir);
-  auto entries = d.entryInfoList(
-      QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
-  auto re = QRegularExpression::fromWildcard(filter);
-  for (QFileInfo info : entries) {
-    if (info.isDir()) {
-      writeDirMD5(dest, info.filePath(), filter);
-    } else {
-      if (re.match(info.fileName()).hasMatch()) {
-        writeFileMD5(dest, info.filePath());
-      }
-    }
-  }
-}
-
-static void writePkgsMD5(QFile &dest, const QString &dir,
-                        const QString &filter) {
-  QDir d(dir);
-  auto entries = d.entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
-  static const QStringList builtinPkgs = {
-    "standard", "standard_cards","test",
-  };
-  for (QFileInfo info : entries) {
-    if (!info.isDir()) continue;
-    auto dirname = info.fileName();
-    if (info.fileName().endsWith(".disabled")) continue;
-    if (builtinPkgs.contains(info.fileName())) continue;
-
-    writeDirMD5(dest, info.filePath(), filter);
-  }
-}
-
 QString calcFileMD5() {
-  // First, generate flist.txt
-  // flist.txt is a file contains all md5sum for code files
-  QFile flist("flist.txt");
-  if (!flist.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
-    qFatal("Cannot open flist.txt. Quitting.");
-  }
-
-  writePkgsMD5(flist, "packages", "*.lua");
-  writePkgsMD5(flist, "packages", "*.qml");
-  writePkgsMD5(flist, "packages", "*.js");
-
-  // then, return flist.txt's md5
-  flist.close();
-  if (!flist.open(QIODevice::ReadOnly)) {
-    qWarning("Cannot open flist.txt for reading.");
-    return QString();
-  }
-  auto ret = QCryptographicHash::hash(flist.readAll(), QCryptographicHash::Md5);
-
-  flist.close();
-  return ret.toHex();
+  return PackageManifest::md5();
 }
 
 QByteArray JsonArray2Bytes(const QJsonArray &arr) {
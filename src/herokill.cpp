@@ -1,10 +1,13 @@
 // SPDX-License-Identifier: GPL-3.0-or-later
 
 #include "client/client.h"
+#include "client/replay_format.h"
+#include "client/replayer.h"
 #include "client/update_client.h"
 #include "core/util.h"
 #include "core/c-wrapper.h"
 #include "core/packman.h"
+#include "core/manifest.h"
 using namespace fkShell;
 
 #if defined(Q_OS_WIN32)
@@ -155,9 +158,6 @@ void fkMsgHandler(QtMsgType type, const QMessageLogContext &context,
                   const QString &msg) {
   auto date = QDate::currentDate();
 
-  std::unique_ptr<QTextStream> ofs(nullptr);
-  ofs.reset(new QTextStream(log_file.get()));
-
   printf("\r");
 
   auto threadName = QThread::currentThread()->objectName();
@@ -204,8 +204,12 @@ void fkMsgHandler(QtMsgType type, const QMessageLogContext &context,
          qUtf16Printable(timeStr), qUtf16Printable(threadName),
          qUtf16Printable(levelMark), qUtf16Printable(msg));
 #endif
-  *ofs << dateStr << " " << timeStr << " " << threadName <<
-    "[" << levelMarkNoColor << "] " << msg << Qt::endl;
+  // 验证录像的子进程不写日志文件，见 herokill_main
+  if (log_file) {
+    QTextStream ofs(log_file.get());
+    ofs << dateStr << " " << timeStr << " " << threadName <<
+      "[" << levelMarkNoColor << "] " << msg << Qt::endl;
+  }
 
 }
 
@@ -273,6 +277,209 @@ RET:
   return ret;
 }
 
+// 把录像目录、单个录像文件或 client.db 中的录像转成 v2 格式
+static int convertReplays(const QString &target) {
+  qint64 before = 0, after = 0;
+  int converted = 0, skipped = 0, failed = 0;
+
+  // encode() 核对过能原样解回来才给出 v2，否则保留原数据
+  auto convertRaw = [&](const QByteArray &raw, QByteArray &result) {
+    if (ReplayFormat::isV2(raw)) {
+      skipped++;
+      return false;
+    }
+    result = ReplayFormat::encode(qUncompress(raw));
+    if (!ReplayFormat::isV2(result)) {
+      failed++;
+      return false;
+    }
+    before += raw.size();
+    after += result.size();
+    converted++;
+    return true;
+  };
+
+  auto convertFile = [&](const QString &path) {
+    QFile f(path);
+    if (!f.open(QIODevice::ReadOnly)) {
+      qWarning() << "Failed to open replay file:" << path;
+      failed++;
+      return;
+    }
+    auto raw = f.readAll();
+    f.close();
+
+    QByteArray result;
+    if (!convertRaw(raw, result)) return;
+    QSaveFile out(path);
+    if (!out.open(QIODevice::WriteOnly) || out.write(result) != result.size() || !out.commit()) {
+      qWarning() << "Failed to write replay file:" << path;
+      failed++;
+    }
+  };
+
+  QFileInfo info(target);
+  if (info.isDir()) {
+    QDir dir(target);
+    for (auto &f : dir.entryList({ "*.fk.rep" }, QDir::Files)) {
+      convertFile(dir.filePath(f));
+    }
+  } else if (target.endsWith(".db")) {
+    if (!info.exists()) {
+      qCritical() << "No such database:" << target;
+      return 1;
+    }
+    Sqlite3 db(target, QString());
+    qint64 lastId = 0;
+    forever {
+      auto rows = db.select(QString("SELECT id, hex(recording) AS r FROM myGameRecordings "
+                                    "WHERE id > %1 ORDER BY id LIMIT 100;").arg(lastId));
+      if (rows.isEmpty()) break;
+      db.exec("BEGIN;");
+      for (auto &row : rows) {
+        lastId = row["id"].toLongLong();
+        QByteArray result;
+        if (!convertRaw(QByteArray::fromHex(row["r"].toLatin1()), result)) continue;
+        db.exec(QString("UPDATE myGameRecordings SET recording = x'%1' WHERE id = %2;")
+                .arg(result.toHex()).arg(lastId));
+      }
+      db.exec("COMMIT;");
+    }
+  } else {
+    convertFile(target);
+  }
+
+  qInfo("converted %d replays (%d already v2, %d failed): %lld -> %lld bytes",
+        converted, skipped, failed, before, after);
+  return failed ? 1 : 0;
+}
+
+// 录像目录展开成其中的录像文件，数据库展开成 "xxx.db#id"
+static QStringList expandReplayTargets(const QStringList &paths) {
+  QStringList ret;
+  for (auto &p : paths) {
+    QFileInfo info(p);
+    if (info.isDir()) {
+      QDir dir(p);
+      for (auto &f : dir.entryList({ "*.fk.rep" }, QDir::Files, QDir::Name)) {
+        ret << dir.filePath(f);
+      }
+    } else if (p.endsWith(".db") && info.exists()) {
+      Sqlite3 db(p, QString());
+      for (auto &row : db.select("SELECT id FROM myGameRecordings ORDER BY id;")) {
+        ret << p + "#" + row["id"];
+      }
+    } else {
+      ret << p;
+    }
+  }
+  return ret;
+}
+
+// 结果行以 REPLAY 开头，和日志输出区分开；父进程只收集这些行
+static void printReplayResult(const QString &target, const Replayer::VerifyResult &r) {
+  auto rate = r.elapsed > 0 ? r.events * 1000.0 / r.elapsed : 0.0;
+  printf("REPLAY\t%s\t%s\t%d\t%.0f\t%d\t%s\n", r.valid ? "ok" : "invalid",
+         qUtf8Printable(target), r.events, rate, r.luaErrors,
+         r.stateHash.isEmpty() ? "-" : r.stateHash.constData());
+  fflush(stdout);
+}
+
+// 不带界面、不等待地把录像跑一遍，输出每个录像的事件速度、Lua 报错数和最终状态的哈希。
+// 录像多于一个且 jobs > 1 时分批交给子进程并行跑（ClientInstance 是全局唯一的）
+static int runReplayVerify(int argc, char *argv[], const QStringList &paths,
+                           int jobs, bool worker) {
+  QCoreApplication app(argc, argv);
+  auto targets = expandReplayTargets(paths);
+  int failed = 0;
+
+  if (!worker) {
+    printf("status\ttarget\tevents\tevents/s\tlua_errors\tstate_hash\n");
+  }
+
+#if QT_CONFIG(process)
+  if (jobs > 1 && targets.size() > 1) {
+    static constexpr int BatchSize = 32;
+    QList<QStringList> batches;
+    for (int i = 0; i < targets.size(); i += BatchSize) {
+      batches << targets.mid(i, BatchSize);
+    }
+
+    // 子进程结束时由 finished 信号收结果、补上下一批，全部结束后退出事件循环
+    int running = 0;
+    std::function<void()> startMore;
+    auto done = [&](QProcess *proc) {
+      proc->deleteLater();
+      running--;
+      startMore();
+      if (running == 0) app.quit();
+    };
+    startMore = [&]() {
+      while (running < jobs && !batches.isEmpty()) {
+        QStringList args { "--replay-verify-worker", "--jobs", "1" };
+        for (auto &t : batches.takeFirst()) {
+          args << "--replay-verify" << t;
+        }
+        auto proc = new QProcess(&app);
+        QObject::connect(proc, &QProcess::finished, &app, [&, proc]() {
+          for (auto &line : proc->readAllStandardOutput().split('\n')) {
+            if (!line.startsWith("REPLAY\t")) continue;
+            auto cols = line.split('\t');
+            if (cols.value(1) != "ok" || cols.value(5).toInt() > 0) failed++;
+            printf("%s\n", line.constData());
+          }
+          if (proc->exitStatus() != QProcess::NormalExit) {
+            qCritical() << "replay verify worker crashed:" << proc->arguments();
+            failed++;
+          }
+          done(proc);
+        });
+        // 没启动起来的不会有 finished
+        QObject::connect(proc, &QProcess::errorOccurred, &app, [&, proc](QProcess::ProcessError e) {
+          if (e != QProcess::FailedToStart) return;
+          qCritical() << "cannot start replay verify worker:" << proc->errorString();
+          failed++;
+          done(proc);
+        });
+        running++;
+        proc->start(QCoreApplication::applicationFilePath(), args);
+      }
+    };
+
+    startMore();
+    if (running > 0) app.exec();
+    fflush(stdout);
+    return failed ? 1 : 0;
+  }
+#endif
+
+  Pacman = new PackMan;
+  // 只跑录像，不碰 client.db 和录像日志；几个 worker 同时跑也不会互相抢
+  auto client = new Client(nullptr, true);
+  for (auto &t : targets) {
+    Replayer *replayer;
+    auto sep = t.lastIndexOf('#');
+    if (sep > 0 && t.left(sep).endsWith(".db")) {
+      Sqlite3 db(t.left(sep), QString());
+      auto ret = db.select(QString("SELECT hex(recording) AS r FROM myGameRecordings "
+                                   "WHERE id = %1;").arg(t.mid(sep + 1).toInt()));
+      replayer = new Replayer(client, QByteArray::fromHex(
+        ret.isEmpty() ? QByteArray() : ret[0]["r"].toLatin1()));
+    } else {
+      replayer = new Replayer(client, QUrl::fromLocalFile(QFileInfo(t).absoluteFilePath()).toString());
+    }
+    auto result = replayer->verify();
+    delete replayer;
+    if (!result.valid || result.luaErrors > 0) failed++;
+    printReplayResult(t, result);
+  }
+
+  delete client;
+  delete Pacman;
+  Pacman = nullptr;
+  return failed ? 1 : 0;
+}
+
 // HeroKill 的程序主入口。整个程序就是从这里开始执行的。
 int herokill_main(int argc, char *argv[]) {
   // 初始化一下各种杂项信息
@@ -295,7 +502,13 @@ int herokill_main(int argc, char *argv[]) {
   }
 #endif
 
-  if (!log_file) {
+  // 验证录像的子进程同时有好几个，都来截断同一个日志文件就乱套了；
+  // 它们的输出由父进程从 stdout 收走
+  bool verifyWorker = false;
+  for (int i = 1; i < argc; i++) {
+    if (qstrcmp(argv[i], "--replay-verify-worker") == 0) verifyWorker = true;
+  }
+  if (!log_file && !verifyWorker) {
     log_file.reset(new QFile("herokill.server.log"));
     if (!log_file->open(QIODevice::WriteOnly | QIODevice::Text)) {
       qFatal("Cannot open info.log");
@@ -311,6 +524,13 @@ int herokill_main(int argc, char *argv[]) {
   parser.addOption({{"h", "help"}, "display help information"});
   parser.addOption({"testskills", "run test case of skills", "testskills"});
   parser.addOption({"testfile", "run test case of a skill file", "testfile"});
+  parser.addOption({"convert-replays", "convert replays (directory, file or client.db) to format v2", "path"});
+  parser.addOption({"replay-verify", "replay recordings (directory, file or client.db) headlessly and report; "
+                    "state_hash is \"-\" unless the Lua client defines GetClientSnapshot", "path"});
+  parser.addOption({"jobs", "number of parallel workers for replay-verify", "n"});
+  QCommandLineOption workerOption("replay-verify-worker");
+  workerOption.setFlags(QCommandLineOption::HiddenFromHelp);
+  parser.addOption(workerOption);
   QStringList cliOptions;
   for (int i = 0; i < argc; i++)
     cliOptions << argv[i];
@@ -328,6 +548,12 @@ int herokill_main(int argc, char *argv[]) {
   } else if (parser.isSet("testfile")) {
     auto val = parser.value("testfile");
     return runSkillTest("", val);
+  } else if (parser.isSet("convert-replays")) {
+    return convertReplays(parser.value("convert-replays"));
+  } else if (parser.isSet("replay-verify")) {
+    auto jobs = parser.isSet("jobs") ? parser.value("jobs").toInt() : QThread::idealThreadCount();
+    return runReplayVerify(argc, argv, parser.values("replay-verify"), qMax(1, jobs),
+                           parser.isSet(workerOption));
   }
 
   app = new QApplication(argc, argv);
@@ -403,6 +629,9 @@ int herokill_main(int argc, char *argv[]) {
   splash.show();
 #endif
 
+  // 工作目录和资源都就绪了，趁界面加载时在后台算好登录要用的清单
+  PackageManifest::precompute();
+
   SHOW_SPLASH_MSG("Loading qml files...");
   engine = new QQmlApplicationEngine;
 
@@ -22,7 +22,11 @@
 #include <cstdlib>
 #include "client/client.h"
 #include "client/clientplayer.h"
+#include "client/db_maintainer.h"
+#include "client/recording_index.h"
+#include "client/replay_format.h"
 #include "client/replayer.h"
+#include "client/spectator_buffer.h"
 #include "core/util.h"
 #include "core/c-wrapper.h"
 #include "network/router.h"
@@ -30,6 +34,7 @@
 QmlBackend *Backend = nullptr;
 
 #include "core/path_resolver.h"
+#include "core/checkout_profile.h"
 
 QmlBackend::QmlBackend(QObject *parent) : QObject(parent) {
   Backend = this;
@@ -152,9 +157,11 @@ void QmlBackend::joinServer(QString address, ushort port, ushort udpPort) {
   connect(client, &Client::notifyUI, this, &QmlBackend::notifyUI);
   engine->rootContext()->setContextProperty("ClientInstance", client);
   engine->rootContext()->setContextProperty("Self", client->getSelf());
+  engine->rootContext()->setContextProperty("Spectator", client->getSpectatorBuffer());
   connect(client, &Client::destroyed, this, [=, this](){
     engine->rootContext()->setContextProperty("Self", &dummyPlayer);
     engine->rootContext()->setContextProperty("ClientInstance", nullptr);
+    engine->rootContext()->setContextProperty("Spectator", nullptr);
   });
   connect(client, &Client::error_message, this, [=, this](const QString &msg) {
     if (replayer) {
@@ -296,7 +303,8 @@ void QmlBackend::playSound(const QString &name, int index) {
       candidates << path;
     }
     if (candidates.isEmpty()) {
-      qWarning() << "Sound file not found:" << resolvedName;
+      if (!CheckoutProfile::isExcludedAsset(resolvedName + ".wav"))
+        qWarning() << "Sound file not found:" << resolvedName;
       return;
     }
     fname = candidates.at(QRandomGenerator::global()->bounded(candidates.size()));
@@ -306,12 +314,23 @@ void QmlBackend::playSound(const QString &name, int index) {
       fname = resolvedName + QString::number(index) + ".wav";
     else
       fname = resolvedName + ".wav";
+    // 检出方案没有下载这个版本的语音，换成留着的第一个版本
+    if (!QFile::exists(fname) && CheckoutProfile::isExcludedAsset(fname)) {
+      for (auto alt : { resolvedName + ".wav", resolvedName + "1.wav" }) {
+        if (QFile::exists(alt)) {
+          fname = alt;
+          break;
+        }
+      }
+    }
   }
 
   // 检查文件是否存在
   QFileInfo fileInfo(fname);
   if (!fileInfo.exists()) {
-    qWarning() << "Sound file not found:" << fname;
+    // 按检出方案本来就没有的，不算错误
+    if (!CheckoutProfile::isExcludedAsset(fname))
+      qWarning() << "Sound file not found:" << fname;
     return;
   }
 
@@ -466,7 +485,9 @@ void QmlBackend::askFixResource() {
 }
 
 void QmlBackend::removeRecord(const QString &fname) {
-  QFile::remove("recording/" + fname);
+  if (QFile::remove("recording/" + fname) && ClientInstance) {
+    ClientInstance->getRecordingIndex()->removeFile(fname);
+  }
 }
 
 void QmlBackend::playRecord(const QString &fname) {
@@ -491,7 +512,7 @@ QString QmlBackend::saveBlobRecordToFile(int id) {
   auto result = ClientInstance->database().select(QString(
     "SELECT hex(recording) as r FROM myGameRecordings WHERE id = %1;").arg(id));
   auto raw = QByteArray::fromHex(result[0]["r"].toLatin1());
-  auto data = qUncompress(raw);
+  auto data = ReplayFormat::toCbor(raw);
   auto arr = QCborValue::fromCbor(data).toArray();
   auto fileName = arr[1].toByteArray();
   ClientInstance->saveRecord(data, fileName);
@@ -502,7 +523,7 @@ void QmlBackend::reviewGameOverScene(int id) {
   auto result = ClientInstance->database().select(QString(
     "SELECT hex(room_data) as r FROM myGameRoomData WHERE id = %1;").arg(id));
   auto raw = QByteArray::fromHex(result[0]["r"].toLatin1());
-  auto data = qUncompress(raw);
+  auto data = DbMaintainer::unpackRoomData(ClientInstance->database(), raw);
   ClientInstance->callLua("Observe", data);
 }
 
@@ -527,15 +548,19 @@ void QmlBackend::setReplayer(Replayer *rep) {
     connect(rep, &Replayer::speed_changed, this, [this](qreal speed) {
         this->notifyUI("ReplayerSpeedChange", QString::number(speed));
         });
+    connect(rep, &Replayer::seekable_changed, this, [this](bool seekable) {
+        this->notifyUI("ReplayerSeekable", seekable);
+        });
     connect(this, &QmlBackend::replayerToggle, rep, &Replayer::toggle);
     connect(this, &QmlBackend::replayerSlowDown, rep, &Replayer::slowDown);
     connect(this, &QmlBackend::replayerSpeedUp, rep, &Replayer::speedUp);
     connect(this, &QmlBackend::replayerUniform, rep, &Replayer::uniform);
     connect(this, &QmlBackend::replayerShutdown, rep, &Replayer::shutdown);
+    connect(this, &QmlBackend::replayerSeek, rep, &Replayer::seek);
   }
 }
 
-void QmlBackend::controlReplayer(QString type) {
+void QmlBackend::controlReplayer(QString type, const QVariant &arg) {
   if (type == "toggle") {
     emit replayerToggle();
   } else if (type == "speedup") {
@@ -546,6 +571,8 @@ void QmlBackend::controlReplayer(QString type) {
     emit replayerUniform();
   } else if (type == "shutdown") {
     emit replayerShutdown();
+  } else if (type == "seek") {
+    emit replayerSeek(arg.toInt());
   }
 }
 
@@ -68,7 +68,8 @@ public:
   Q_INVOKABLE void reviewGameOverScene(int);
   Replayer *getReplayer() const;
   void setReplayer(Replayer *rep);
-  Q_INVOKABLE void controlReplayer(QString type);
+  // type 为 seek 时 arg 是要跳到的秒数
+  Q_INVOKABLE void controlReplayer(QString type, const QVariant &arg = QVariant());
 
   Q_INVOKABLE QJsonObject getRequestData() const;
 
@@ -82,6 +83,7 @@ signals:
   void replayerSlowDown();
   void replayerUniform();
   void replayerShutdown();
+  void replayerSeek(int secs);
 
 private slots:
   void readPendingDatagrams();
@@ -0,0 +1,77 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <QTest>
+#include "client/blob_codec.h"
+
+class TestBlobCodec : public QObject {
+  Q_OBJECT
+
+private:
+  QList<QByteArray> samples;
+
+  // 结构相同、细节不同的房间快照
+  static QByteArray makeRoom(int seed) {
+    QCborArray players;
+    for (int i = 0; i < 8; i++) {
+      players << QCborMap {
+        { "id", seed * 10 + i },
+        { "general", QString("general_%1").arg((seed + i) % 40) },
+        { "hp", (seed + i) % 5 },
+        { "handcards", QCborArray { (seed * 7 + i) % 160, (seed * 3 + i) % 160 } },
+        { "skills", QCborArray { "jianxiong", "hujia", "fankui", "guicai" } },
+      };
+    }
+    return QCborMap {
+      { "settings", QCborMap {{ "gameMode", "aaa_role_mode" }, { "timeout", 15 }} },
+      { "players", players },
+      { "round", seed % 20 },
+    }.toCborValue().toCbor();
+  }
+
+private slots:
+  void initTestCase() {
+    for (int i = 0; i < 64; i++) samples << makeRoom(i);
+  }
+
+  void roundTrip() {
+    auto dict = BlobCodec::train(samples, 4096);
+    QVERIFY(!dict.isEmpty());
+    QVERIFY(dict.size() <= 4096);
+    for (int i = 100; i < 110; i++) {
+      auto data = makeRoom(i);
+      auto packed = BlobCodec::compress(data, dict, 3);
+      QVERIFY(BlobCodec::isDict(packed));
+      QCOMPARE(BlobCodec::dictId(packed), qint64(3));
+      QCOMPARE(BlobCodec::decompress(packed, dict), data);
+    }
+  }
+
+  void smallerThanQCompress() {
+    auto dict = BlobCodec::train(samples);
+    qint64 a = 0, b = 0;
+    for (int i = 100; i < 200; i++) {
+      auto data = makeRoom(i);
+      a += qCompress(data).size();
+      b += BlobCodec::compress(data, dict, 1).size();
+    }
+    qInfo("qCompress %lld bytes, dictionary %lld bytes", a, b);
+    QVERIFY(b < a);
+  }
+
+  void legacy() {
+    auto data = makeRoom(1);
+    QCOMPARE(BlobCodec::dictId(qCompress(data)), qint64(-1));
+    QCOMPARE(BlobCodec::decompress(qCompress(data), QByteArray()), data);
+  }
+
+  // 字典不对或数据损坏时返回空，不能越界
+  void corrupted() {
+    auto dict = BlobCodec::train(samples);
+    auto packed = BlobCodec::compress(makeRoom(1), dict, 1);
+    QCOMPARE(BlobCodec::decompress(packed, dict.left(16)), QByteArray());
+    QCOMPARE(BlobCodec::decompress(packed.left(packed.size() / 2), dict), QByteArray());
+  }
+};
+
+QTEST_GUILESS_MAIN(TestBlobCodec)
+#include "test_blob_codec.moc"
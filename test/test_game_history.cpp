@@ -0,0 +1,194 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <QTest>
+#include <QFile>
+#include <numeric>
+#include <sqlite3.h>
+#include "client/game_history.h"
+
+class TestGameHistory : public QObject {
+  Q_OBJECT
+
+private:
+  sqlite3 *db = nullptr;
+  static constexpr int RowCount = 100000;
+
+  QList<qint64> selectIds(const QString &sql, int column = 0) {
+    QList<qint64> ret;
+    sqlite3_stmt *stmt = nullptr;
+    auto bytes = sql.toUtf8();
+    if (sqlite3_prepare_v2(db, bytes.constData(), -1, &stmt, nullptr) != SQLITE_OK)
+      return ret;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+      ret << sqlite3_column_int64(stmt, column);
+    sqlite3_finalize(stmt);
+    return ret;
+  }
+
+  QString queryPlan(const QString &sql) {
+    QString ret;
+    sqlite3_stmt *stmt = nullptr;
+    auto bytes = ("EXPLAIN QUERY PLAN " + sql).toUtf8();
+    if (sqlite3_prepare_v2(db, bytes.constData(), -1, &stmt, nullptr) != SQLITE_OK)
+      return ret;
+    while (sqlite3_step(stmt) == SQLITE_ROW)
+      ret += QString::fromUtf8((const char *)sqlite3_column_text(stmt, 3)) + '\n';
+    sqlite3_finalize(stmt);
+    return ret;
+  }
+
+private slots:
+  void initTestCase() {
+    QFile f(FK_SOURCE_DIR "/client/init.sql");
+    QVERIFY(f.open(QIODevice::ReadOnly));
+    QCOMPARE(sqlite3_open(":memory:", &db), SQLITE_OK);
+    QCOMPARE(sqlite3_exec(db, f.readAll().constData(), nullptr, nullptr, nullptr), SQLITE_OK);
+
+    // 10 万局，两个玩家交替，混合几个模式和胜负
+    sqlite3_exec(db, "BEGIN;", nullptr, nullptr, nullptr);
+    sqlite3_stmt *stmt = nullptr;
+    sqlite3_prepare_v2(db, "INSERT INTO myGameData "
+      "(time, pid, server_addr, mode, general, deputy_general, role, result) "
+      "VALUES (?, ?, '127.0.0.1:9527', ?, ?, '', 'lord', ?);", -1, &stmt, nullptr);
+    static const char *modes[] = { "aaa_role_mode", "m_1v2_mode", "m_2v2_mode" };
+    static const char *generals[] = { "liubei", "caocao", "sunquan", "zhangfei" };
+    for (int i = 0; i < RowCount; i++) {
+      sqlite3_bind_int64(stmt, 1, 1700000000 + i);
+      sqlite3_bind_int(stmt, 2, i % 2 ? 1 : 2);
+      sqlite3_bind_text(stmt, 3, modes[i % 3], -1, SQLITE_STATIC);
+      sqlite3_bind_text(stmt, 4, generals[i % 4], -1, SQLITE_STATIC);
+      sqlite3_bind_int(stmt, 5, i % 3 + 1);
+      sqlite3_step(stmt);
+      sqlite3_reset(stmt);
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+  }
+
+  void cleanupTestCase() {
+    sqlite3_close(db);
+  }
+
+  void buildDefault() {
+    GameHistoryQuery q;
+    q.pid = 1;
+    q.serverAddr = "127.0.0.1:9527";
+    QCOMPARE(buildGameHistoryQuery(q),
+             QString("SELECT * FROM myGameData WHERE pid = 1 AND server_addr = '127.0.0.1:9527'"
+                     " ORDER BY id DESC LIMIT 50;"));
+  }
+
+  void buildFilters() {
+    auto q = gameHistoryQueryFromVariant({
+      { "mode", "m_1v2_mode" }, { "general", "o'neil" }, { "result", 1 },
+    });
+    q.pid = 1;
+    q.serverAddr = "a";
+    q.beforeId = 300;
+    q.limit = 100000;
+    QCOMPARE(buildGameHistoryQuery(q),
+             QString("SELECT * FROM myGameData WHERE pid = 1 AND server_addr = 'a'"
+                     " AND id < 300 AND mode = 'm_1v2_mode'"
+                     " AND (general = 'o''neil' OR deputy_general = 'o''neil')"
+                     " AND result = 1 ORDER BY id DESC LIMIT 500;"));
+  }
+
+  void usesIndex() {
+    GameHistoryQuery q;
+    q.pid = 1;
+    q.serverAddr = "127.0.0.1:9527";
+    q.beforeId = 5000;
+    auto plan = queryPlan(buildGameHistoryQuery(q));
+    QVERIFY2(plan.contains("myGameData_owner"), qPrintable(plan));
+    QVERIFY2(!plan.contains("TEMP B-TREE"), qPrintable(plan));
+  }
+
+  void paginate() {
+    GameHistoryQuery q;
+    q.pid = 1;
+    q.serverAddr = "127.0.0.1:9527";
+    q.limit = 20;
+    auto first = selectIds(buildGameHistoryQuery(q));
+    QCOMPARE(first.length(), 20);
+    QCOMPARE(first.first(), qint64(RowCount));
+
+    q.beforeId = first.last();
+    auto second = selectIds(buildGameHistoryQuery(q));
+    QCOMPARE(second.length(), 20);
+    QCOMPARE(second.first(), first.last() - 2);
+  }
+
+  // trigger 维护的聚合表要和原始战绩逐组对得上
+  void statsMatchRaw() {
+    auto q = gameStatsQueryFromVariant("mode", {{ "general", "caocao" }});
+    q.pid = 1;
+    q.serverAddr = "127.0.0.1:9527";
+    auto fromStats = selectIds(buildGameStatsQuery(q), 4); // total
+    auto wins = selectIds(buildGameStatsQuery(q), 1);
+
+    auto fromRaw = selectIds("SELECT count() AS c FROM myGameData WHERE pid = 1 AND "
+                             "server_addr = '127.0.0.1:9527' AND general = 'caocao' "
+                             "GROUP BY mode ORDER BY c DESC;");
+    auto rawWins = selectIds("SELECT count() AS c FROM myGameData WHERE pid = 1 AND "
+                             "server_addr = '127.0.0.1:9527' AND general = 'caocao' "
+                             "AND result = 1;");
+    QVERIFY(!fromRaw.isEmpty());
+    QCOMPARE(fromStats, fromRaw);
+    QCOMPARE(std::accumulate(wins.cbegin(), wins.cend(), qint64(0)), rawWins.first());
+  }
+
+  void benchStats() {
+    auto q = gameStatsQueryFromVariant("general", {});
+    q.pid = 1;
+    q.serverAddr = "127.0.0.1:9527";
+    auto sql = buildGameStatsQuery(q);
+    QBENCHMARK {
+      selectIds(sql);
+    }
+  }
+
+  void benchFirstPage() {
+    GameHistoryQuery q;
+    q.pid = 1;
+    q.serverAddr = "127.0.0.1:9527";
+    auto sql = buildGameHistoryQuery(q);
+    QBENCHMARK {
+      selectIds(sql);
+    }
+  }
+
+  void benchDeepPage() {
+    GameHistoryQuery q;
+    q.pid = 2;
+    q.serverAddr = "127.0.0.1:9527";
+    q.beforeId = 1000;
+    auto sql = buildGameHistoryQuery(q);
+    QBENCHMARK {
+      selectIds(sql);
+    }
+  }
+
+  void benchFiltered() {
+    GameHistoryQuery q;
+    q.pid = 1;
+    q.serverAddr = "127.0.0.1:9527";
+    q.mode = "m_2v2_mode";
+    q.result = 1;
+    auto sql = buildGameHistoryQuery(q);
+    QBENCHMARK {
+      selectIds(sql);
+    }
+  }
+
+  // 对照：旧的 getMyGameData 全表返回
+  void benchUnbounded() {
+    auto sql = QString("SELECT * FROM myGameData WHERE pid = 1 AND "
+                       "server_addr = '127.0.0.1:9527' ORDER BY id DESC;");
+    QBENCHMARK {
+      selectIds(sql);
+    }
+  }
+};
+
+QTEST_MAIN(TestGameHistory)
+#include "test_game_history.moc"
@@ -0,0 +1,224 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <QTest>
+#include <git2.h>
+#include "core/manifest.h"
+
+class TestManifest : public QObject {
+  Q_OBJECT
+
+private:
+  QTemporaryDir tmp;
+
+  // 原来的 calcFileMD5 写 flist.txt 的做法，用来核对清单逐字节相同
+  static void legacyFile(QByteArray &dest, const QString &fname) {
+    QFile f(fname);
+    if (!f.open(QIODevice::ReadOnly)) return;
+    auto data = f.readAll();
+    data.replace(QByteArray("\r\n"), QByteArray("\n"));
+    auto hash = QCryptographicHash::hash(data, QCryptographicHash::Md5).toHex();
+    dest += fname.toUtf8() + '=' + hash + ';';
+  }
+
+  static void legacyDir(QByteArray &dest, const QString &dir, const QString &filter) {
+    auto entries = QDir(dir).entryInfoList(
+        QDir::Files | QDir::Dirs | QDir::NoDotAndDotDot, QDir::Name);
+    auto re = QRegularExpression::fromWildcard(filter);
+    for (QFileInfo info : entries) {
+      if (info.isDir()) {
+        legacyDir(dest, info.filePath(), filter);
+      } else if (re.match(info.fileName()).hasMatch()) {
+        legacyFile(dest, info.filePath());
+      }
+    }
+  }
+
+  static QByteArray legacy() {
+    QByteArray ret;
+    static const QStringList builtinPkgs = { "standard", "standard_cards", "test" };
+    for (auto filter : { "*.lua", "*.qml", "*.js" }) {
+      for (QFileInfo info : QDir("packages").entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot,
+                                                           QDir::Name)) {
+        if (info.fileName().endsWith(".disabled")) continue;
+        if (builtinPkgs.contains(info.fileName())) continue;
+        legacyDir(ret, info.filePath(), filter);
+      }
+    }
+    return ret;
+  }
+
+  // 按 git-tree 格式的规则直接读磁盘上的文件算出的清单
+  static QByteArray expectedGitManifest() {
+    QMap<QByteArray, QByteArray> lists[3];
+    for (QFileInfo pkg : QDir("packages").entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot)) {
+      auto name = pkg.fileName();
+      if (name.endsWith(".disabled") || name == "standard") continue;
+      QDirIterator it(pkg.filePath(), QDir::Files, QDirIterator::Subdirectories);
+      while (it.hasNext()) {
+        auto path = it.next();
+        int k = PackageManifest::kindOf(QFileInfo(path).fileName());
+        if (k < 0) continue;
+        QFile f(path);
+        if (!f.open(QIODevice::ReadOnly)) continue;
+        auto data = f.readAll();
+        git_oid oid;
+        git_odb_hash(&oid, data.constData(), data.size(), GIT_OBJECT_BLOB);
+        char buf[GIT_OID_HEXSZ + 1] = {0};
+        git_oid_tostr(buf, sizeof(buf), &oid);
+        lists[k][path.toUtf8()] = buf;
+      }
+    }
+    QByteArray ret;
+    for (auto &list : lists) {
+      for (auto it = list.cbegin(); it != list.cend(); it++) ret += it.key() + '=' + it.value() + ';';
+    }
+    return ret;
+  }
+
+  // 把 dir 下的所有文件提交成一个仓库
+  static void commitAll(const QString &dir) {
+    git_repository *repo = NULL;
+    git_index *index = NULL;
+    git_signature *sig = NULL;
+    git_tree *tree = NULL;
+    git_oid treeId, commitId;
+    QCOMPARE(git_repository_init(&repo, dir.toUtf8(), 0), 0);
+    git_repository_index(&index, repo);
+    git_index_add_all(index, NULL, 0, NULL, NULL);
+    git_index_write(index);
+    git_index_write_tree(&treeId, index);
+    git_tree_lookup(&tree, repo, &treeId);
+    git_signature_now(&sig, "test", "test@example.com");
+    git_commit_create(&commitId, repo, "HEAD", sig, sig, NULL, "init", tree, 0, NULL);
+    git_tree_free(tree);
+    git_signature_free(sig);
+    git_index_free(index);
+    git_repository_free(repo);
+  }
+
+  static void write(const QString &path, const QByteArray &data) {
+    QDir().mkpath(QFileInfo(path).path());
+    QFile f(path);
+    QVERIFY(f.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    f.write(data);
+  }
+
+private slots:
+  void initTestCase() {
+    QVERIFY(tmp.isValid());
+    git_libgit2_init();
+    QVERIFY(QDir::setCurrent(tmp.path()));
+
+    write("packages/alpha/init.lua", "return {}\r\n");
+    write("packages/alpha/Aa.lua", "-- upper case first\n");
+    write("packages/alpha/b/skill.lua", "local a = 1\r\nreturn a\r\n");
+    write("packages/alpha/b/view.qml", "Item {}\n");
+    write("packages/alpha/c.js", "var x;\n");
+    write("packages/alpha/readme.md", "not listed\n");
+    write("packages/alpha/.hidden.lua", "hidden\n");
+    write("packages/alpha/sub.lua/inner.lua", "dir named like a file\n");
+    write("packages/beta/init.lua", "");
+    write("packages/beta/ui/Main.QML", "wrong case\n");
+    write("packages/standard/init.lua", "builtin\n");
+    write("packages/gamma.disabled/init.lua", "disabled\n");
+    write("packages/loose.lua", "top-level file\n");
+    for (int i = 0; i < 300; i++) {
+      write(QString("packages/many/f%1.lua").arg(i), QByteArray::number(i));
+    }
+  }
+
+  void cleanupTestCase() {
+    git_libgit2_shutdown();
+  }
+
+  void sameAsLegacy() {
+    QFile::remove("flist.cache");
+    QCOMPARE(PackageManifest::build(), legacy());
+    // 第二次全部来自缓存
+    QCOMPARE(PackageManifest::build(), legacy());
+  }
+
+  void detectsChanges() {
+    PackageManifest::build();
+    write("packages/alpha/init.lua", "return { changed = true }\n");
+    write("packages/beta/new.js", "new\n");
+    QFile::remove("packages/many/f7.lua");
+    QCOMPARE(PackageManifest::build(), legacy());
+  }
+
+  // 缓存是按大小和修改时间认的，修改时间不同就要重算
+  void sameSizeDifferentContent() {
+    write("packages/beta/init.lua", "aaaa");
+    QFile f("packages/beta/init.lua");
+    QVERIFY(f.open(QIODevice::ReadWrite));
+    f.setFileTime(QDateTime::currentDateTime().addSecs(-3600), QFileDevice::FileModificationTime);
+    f.close();
+    QCOMPARE(PackageManifest::build(), legacy());
+
+    write("packages/beta/init.lua", "bbbb");
+    QCOMPARE(PackageManifest::build(), legacy());
+  }
+
+  void md5() {
+    QCOMPARE(PackageManifest::md5(),
+             QString(QCryptographicHash::hash(legacy(), QCryptographicHash::Md5).toHex()));
+  }
+
+  void gitManifest() {
+    write("packages/delta/init.lua", "return 1\r\n");
+    write("packages/delta/ui/Card.qml", "Item {}\n");
+    write("packages/delta/lib/util.js", "var y;\n");
+    write("packages/delta/gone.lua", "to be deleted\n");
+    write("packages/delta/image.png", "png");
+    commitAll("packages/delta");
+    QCOMPARE(PackageManifest::buildFromGit(), expectedGitManifest());
+
+    // 工作区的改动要反映出来
+    write("packages/delta/init.lua", "return 2\n");
+    write("packages/delta/extra.lua", "untracked\n");
+    QVERIFY(QFile::remove("packages/delta/gone.lua"));
+    QCOMPARE(PackageManifest::buildFromGit(), expectedGitManifest());
+
+    // 旧格式不受影响
+    QCOMPARE(PackageManifest::build(), legacy());
+    QCOMPARE(PackageManifest::formats().value("git-tree").toString(),
+             QString(QCryptographicHash::hash(expectedGitManifest(),
+                                              QCryptographicHash::Md5).toHex()));
+  }
+
+  void precomputedLogin() {
+    PackageManifest::precompute();
+    auto first = PackageManifest::login();
+    QCOMPARE(first.result().md5, PackageManifest::md5());
+
+    // 包有变化之后拿到的是重新算的结果
+    write("packages/beta/late.lua", "late\n");
+    PackageManifest::invalidate();
+    auto second = PackageManifest::login();
+    QCOMPARE(second.result().md5, PackageManifest::md5());
+    QVERIFY(second.result().md5 != first.result().md5);
+    QCOMPARE(second.result().formats, PackageManifest::formats());
+  }
+
+  // 启动时 precompute() 比 PackMan 先跑，那时还没有人调用过 git_libgit2_init()
+  void loginWithoutLibgit2Init() {
+    while (git_libgit2_shutdown() > 0) {}
+    PackageManifest::invalidate();
+    auto formats = PackageManifest::login().result().formats;
+    // 算完之后自己那一份也放掉了
+    QCOMPARE(git_libgit2_init(), 1);
+    QCOMPARE(formats.value("git-tree").toString(),
+             QString(QCryptographicHash::hash(expectedGitManifest(),
+                                              QCryptographicHash::Md5).toHex()));
+  }
+
+  void benchBuild() {
+    PackageManifest::build();
+    QBENCHMARK {
+      PackageManifest::build();
+    }
+  }
+};
+
+QTEST_GUILESS_MAIN(TestManifest)
+#include "test_manifest.moc"
@@ -0,0 +1,369 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <QTest>
+#include <git2.h>
+#include "core/packman.h"
+#include "core/package_repo.h"
+#include "core/object_store.h"
+#include "core/checkout_profile.h"
+#include "core/download_progress.h"
+
+// 用本地裸仓库代替服务器上的扩展包仓库
+class TestPackMan : public QObject {
+  Q_OBJECT
+
+private:
+  QTemporaryDir tmp;
+  QString origin;
+  QString url;
+  QStringList commits; // 依次提交的哈希，init.lua 的内容是序号
+
+  // 在裸仓库的 ref（默认 master）上追加一个只有 init.lua 的提交，
+  // ref 还不存在的话接在 master 后面
+  static QString commit(git_repository *repo, const QByteArray &content,
+                        const char *ref = "refs/heads/master") {
+    git_oid blob, tree, oid, parentOid;
+    git_treebuilder *builder = NULL;
+    git_tree *t = NULL;
+    git_commit *parent = NULL;
+    git_signature *sig = NULL;
+
+    git_blob_create_from_buffer(&blob, repo, content.constData(), content.size());
+    git_treebuilder_new(&builder, repo, NULL);
+    git_treebuilder_insert(NULL, builder, "init.lua", &blob, GIT_FILEMODE_BLOB);
+    git_treebuilder_write(&tree, builder);
+    git_tree_lookup(&t, repo, &tree);
+    git_signature_now(&sig, "test", "test@example.com");
+
+    if (git_reference_name_to_id(&parentOid, repo, ref) == 0 ||
+        git_reference_name_to_id(&parentOid, repo, "refs/heads/master") == 0)
+      git_commit_lookup(&parent, repo, &parentOid);
+    const git_commit *parents[] = { parent };
+    git_commit_create(&oid, repo, ref, sig, sig, NULL, content.constData(),
+                      t, parent ? 1 : 0, parents);
+
+    char buf[GIT_OID_HEXSZ + 1] = {0};
+    git_oid_tostr(buf, sizeof(buf), &oid);
+    git_commit_free(parent);
+    git_signature_free(sig);
+    git_tree_free(t);
+    git_treebuilder_free(builder);
+    return QString(buf);
+  }
+
+  static QString summary(const QString &url, const QString &hash) {
+    return QJsonDocument(QJsonArray {
+      QJsonObject {{ "name", "demo" }, { "url", url }, { "hash", hash }},
+    }).toJson(QJsonDocument::Compact);
+  }
+
+  static QByteArray workspaceContent() {
+    QFile f("packages/demo/init.lua");
+    if (!f.open(QIODevice::ReadOnly)) return QByteArray();
+    return f.readAll();
+  }
+
+  // 带音频和图片的包：工作目录里写好文件，全部提交
+  static void makeAssetRepo(const QString &path) {
+    const QMap<QString, QByteArray> files {
+      { "init.lua", "return {}" },
+      { "audio/skill/a.wav", "a" },
+      { "audio/skill/a2.wav", "a2" },
+      { "audio/voice.lua", "return {}" },
+      { "image/x.png", "png" },
+    };
+    for (auto it = files.cbegin(); it != files.cend(); it++) {
+      auto file = QDir(path).filePath(it.key());
+      QDir().mkpath(QFileInfo(file).path());
+      QFile f(file);
+      f.open(QIODevice::WriteOnly);
+      f.write(it.value());
+    }
+
+    git_repository *repo = NULL;
+    git_index *index = NULL;
+    git_oid tree, oid;
+    git_tree *t = NULL;
+    git_signature *sig = NULL;
+    git_repository_init(&repo, path.toUtf8(), 0);
+    git_repository_index(&index, repo);
+    git_index_add_all(index, NULL, 0, NULL, NULL);
+    git_index_write(index);
+    git_index_write_tree(&tree, index);
+    git_tree_lookup(&t, repo, &tree);
+    git_signature_now(&sig, "test", "test@example.com");
+    git_commit_create(&oid, repo, "HEAD", sig, sig, NULL, "assets", t, 0, NULL);
+    git_signature_free(sig);
+    git_tree_free(t);
+    git_index_free(index);
+    git_repository_free(repo);
+  }
+
+  static QString recordedHash(const QString &name = "demo") {
+    QFile f("packages/packages.json");
+    if (!f.open(QIODevice::ReadOnly)) return QString();
+    for (auto e : QJsonDocument::fromJson(f.readAll()).array()) {
+      auto obj = e.toObject();
+      if (obj["name"].toString() == name) return obj["hash"].toString();
+    }
+    return QString();
+  }
+
+private slots:
+  void initTestCase() {
+    QVERIFY(tmp.isValid());
+    git_libgit2_init();
+    origin = tmp.filePath("origin/demo.git");
+    url = QUrl::fromLocalFile(origin).toString();
+
+    git_repository *repo = NULL;
+    QCOMPARE(git_repository_init(&repo, origin.toUtf8(), 1), 0);
+    for (int i = 1; i <= 3; i++) {
+      commits << commit(repo, QByteArray::number(i));
+    }
+    git_repository_set_head(repo, "refs/heads/master");
+    git_repository_free(repo);
+
+    QDir(tmp.path()).mkpath("work/packages");
+    QVERIFY(QDir::setCurrent(tmp.filePath("work")));
+  }
+
+  void cleanupTestCase() {
+    git_libgit2_shutdown();
+  }
+
+  void init() {
+    QDir("packages/demo").removeRecursively();
+    QDir("packages/fork").removeRecursively();
+    QDir("packages/assets").removeRecursively();
+    QFile::remove("packages/packages.json");
+  }
+
+  void syncLatest() {
+    PackMan pm;
+    pm.loadSummary(summary(url, commits[2]));
+    QCOMPARE(workspaceContent(), QByteArray("3"));
+    QCOMPARE(recordedHash(), commits[2]);
+  }
+
+  // 服务器要的是本地已有的旧提交，直接切过去
+  void syncOlderCommit() {
+    PackMan pm;
+    pm.loadSummary(summary(url, commits[0]));
+    QCOMPARE(workspaceContent(), QByteArray("1"));
+    QCOMPARE(recordedHash(), commits[0]);
+
+    // 已有仓库上再切到别的提交
+    PackMan again;
+    again.loadSummary(summary(url, commits[1]));
+    QCOMPARE(workspaceContent(), QByteArray("2"));
+    QCOMPARE(recordedHash(), commits[1]);
+  }
+
+  // 服务器要的提交不在任何分支上，按配置拉取拿不到，只能按哈希拉取
+  void syncCommitByHash() {
+    PackMan pm;
+    pm.loadSummary(summary(url, commits[2]));
+    QCOMPARE(workspaceContent(), QByteArray("3"));
+
+    git_repository *repo = NULL;
+    QCOMPARE(git_repository_open(&repo, origin.toUtf8()), 0);
+    auto hidden = commit(repo, "hidden", "refs/hidden/extra");
+    git_repository_free(repo);
+
+    PackMan again;
+    again.loadSummary(summary(url, hidden));
+    QCOMPARE(workspaceContent(), QByteArray("hidden"));
+    QCOMPARE(recordedHash(), hidden);
+  }
+
+  void syncFullClone() {
+    PackMan pm;
+    pm.loadSummary(summary(url, commits[1]));
+    QCOMPARE(workspaceContent(), QByteArray("2"));
+  }
+
+  // stat 快照判断工作区是否干净，结果要和 libgit2 的完整 status 一致
+  void dirtyDetection() {
+    PackMan pm;
+    pm.loadSummary(summary(url, commits[2]));
+    QTest::qWait(1100); // 快照前后一秒内改动的文件总是复查，等过去再测快路径
+
+    PackageRepo repo("packages/demo");
+    QCOMPARE(repo.status(), 0);
+    QVERIFY(QFile::exists("packages/demo/.git/fk-stat-snapshot"));
+
+    // 只改了修改时间，内容没变
+    QFile f("packages/demo/init.lua");
+    QVERIFY(f.open(QIODevice::ReadWrite));
+    f.setFileTime(QDateTime::currentDateTime().addSecs(-3600), QFileDevice::FileModificationTime);
+    f.close();
+    QCOMPARE(repo.status(), 0);
+
+    QVERIFY(f.open(QIODevice::WriteOnly | QIODevice::Truncate));
+    f.write("changed");
+    f.close();
+    QCOMPARE(repo.status(), 100);
+    QCOMPARE(repo.reset(), 0);
+    QCOMPARE(repo.status(), 0);
+
+    QFile extra("packages/demo/extra.lua");
+    QVERIFY(extra.open(QIODevice::WriteOnly));
+    extra.close();
+    QCOMPARE(repo.status(), 100);
+    extra.remove();
+    QCOMPARE(repo.status(), 0);
+
+    QVERIFY(QFile::remove("packages/demo/init.lua"));
+    QCOMPARE(repo.status(), 100);
+  }
+
+  // fork 和原包的对象搬进共享库只存一份，包照常能用、能更新
+  void sharedObjects() {
+    auto forkPath = tmp.filePath("origin/fork.git");
+    git_repository *fork = NULL;
+    git_clone_options opt;
+    git_clone_init_options(&opt, GIT_CLONE_OPTIONS_VERSION);
+    opt.bare = 1;
+    QCOMPARE(git_clone(&fork, url.toUtf8(), forkPath.toUtf8(), &opt), 0);
+    auto forkHead = commit(fork, "fork");
+    git_repository_free(fork);
+
+    PackMan pm;
+    pm.setSharedObjects(false);
+    auto json = QJsonDocument(QJsonArray {
+      QJsonObject {{ "name", "demo" }, { "url", url }, { "hash", commits[2] }},
+      QJsonObject {{ "name", "fork" }, { "url", QUrl::fromLocalFile(forkPath).toString() },
+                   { "hash", forkHead }},
+    }).toJson(QJsonDocument::Compact);
+    pm.loadSummary(json);
+
+    auto report = pm.compactObjects();
+    QCOMPARE(report["failed"].toInt(), 0);
+    QCOMPARE(report["absorbed"].toInt(), 2);
+    QVERIFY(report["reclaimedSize"].toLongLong() > 0);
+
+    SharedObjectStore store;
+    QVERIFY(store.exists());
+    QVERIFY(store.isAttached("packages/demo"));
+    QVERIFY(store.isAttached("packages/fork"));
+    QCOMPARE(PackageRepo("packages/demo").status(), 0);
+    QCOMPARE(PackageRepo("packages/fork").status(), 0);
+    QCOMPARE(workspaceContent(), QByteArray("3"));
+    QFile f("packages/fork/init.lua");
+    QVERIFY(f.open(QIODevice::ReadOnly));
+    QCOMPARE(f.readAll(), QByteArray("fork"));
+    f.close();
+
+    // 再整理一次没有东西可搬
+    QCOMPARE(pm.compactObjects()["absorbed"].toInt(), 0);
+
+    // 旧提交的对象现在只在共享库里
+    PackMan again;
+    again.loadSummary(summary(url, commits[0]));
+    QCOMPARE(workspaceContent(), QByteArray("1"));
+  }
+
+  // 检出方案跳过的文件不在工作区，也不算改动；换方案时增删文件
+  void checkoutProfile() {
+    auto assets = tmp.filePath("origin/assets");
+    makeAssetRepo(assets);
+    git_repository *repo = NULL;
+    QCOMPARE(git_repository_open(&repo, assets.toUtf8()), 0);
+    git_oid oid;
+    git_reference_name_to_id(&oid, repo, "HEAD");
+    char buf[GIT_OID_HEXSZ + 1] = {0};
+    git_oid_tostr(buf, sizeof(buf), &oid);
+    git_repository_free(repo);
+
+    QVERIFY(CheckoutProfile::setCurrent("no-audio"));
+    PackMan pm;
+    pm.loadSummary(QJsonDocument(QJsonArray {
+      QJsonObject {{ "name", "assets" }, { "url", QUrl::fromLocalFile(assets).toString() },
+                   { "hash", QString(buf) }},
+    }).toJson(QJsonDocument::Compact));
+
+    QVERIFY(QFile::exists("packages/assets/init.lua"));
+    QVERIFY(QFile::exists("packages/assets/image/x.png"));
+    QVERIFY(QFile::exists("packages/assets/audio/voice.lua")); // 代码文件总是检出
+    QVERIFY(!QFile::exists("packages/assets/audio/skill/a.wav"));
+    QVERIFY(CheckoutProfile::isExcludedAsset("packages/assets/audio/skill/a.wav"));
+    QVERIFY(!CheckoutProfile::isExcludedAsset("packages/assets/image/x.png"));
+    QCOMPARE(PackageRepo("packages/assets").status(), 0);
+    QCOMPARE(recordedHash("assets"), QString(buf));
+
+    pm.setCheckoutProfile("low-storage");
+    QVERIFY(QFile::exists("packages/assets/audio/skill/a.wav"));
+    QVERIFY(!QFile::exists("packages/assets/audio/skill/a2.wav"));
+    QCOMPARE(PackageRepo("packages/assets").status(), 0);
+
+    pm.setCheckoutProfile("full");
+    QCOMPARE(pm.getCheckoutProfile(), QString("full"));
+    QVERIFY(QFile::exists("packages/assets/audio/skill/a2.wav"));
+    QVERIFY(!CheckoutProfile::isExcludedAsset("packages/assets/audio/skill/a2.wav"));
+    QCOMPARE(PackageRepo("packages/assets").status(), 0);
+  }
+
+  // 几个下载线程不停地报进度，界面每秒最多收到 maxRate 次，数字是所有包的总和
+  void progressRateLimited() {
+    DownloadProgress p;
+    p.setMaxRate(10);
+    int changes = 0;
+    bool sawEta = false;
+    qreal maxSpeed = 0;
+    connect(&p, &DownloadProgress::changed, this, [&]() {
+      changes++;
+      maxSpeed = qMax(maxSpeed, p.bytesPerSecond());
+      if (p.isActive() && p.eta() >= 0) sawEta = true;
+    });
+
+    QElapsedTimer timer;
+    timer.start();
+    auto future = QtConcurrent::map(QList<int> { 0, 1, 2, 3 }, [&p](int i) {
+      auto name = QString("pack%1").arg(i);
+      for (int n = 1; n <= 2000; n++) {
+        git_indexer_progress s = {};
+        s.total_objects = 2000;
+        s.received_objects = n;
+        s.indexed_objects = n;
+        s.received_bytes = n * 1000;
+        p.update(name, s);
+        if (n % 100 == 0) QThread::msleep(20);
+      }
+      p.finish(name);
+    });
+    while (!future.isFinished()) QTest::qWait(10);
+    QTest::qWait(300);
+
+    QCOMPARE(p.receivedObjects(), qint64(8000));
+    QCOMPARE(p.totalObjects(), qint64(8000));
+    QCOMPARE(p.progress(), 1.0);
+    QVERIFY(!p.isActive());
+    QCOMPARE(p.bytesPerSecond(), 0.0);
+    QVERIFY(maxSpeed > 0);
+    QVERIFY(sawEta);
+    // 8000 次回调只变成了几次属性通知
+    qInfo("%d updates in %lld ms", changes, timer.elapsed());
+    QVERIFY(changes >= 2);
+    QVERIFY(changes <= timer.elapsed() / 100 + 3);
+  }
+
+  // 一个包失败不影响其他包，也不写进 packages.json
+  void failureIsolated() {
+    PackMan pm;
+    pm.setSyncWorkers(2);
+    auto missing = QUrl::fromLocalFile(tmp.filePath("origin/missing.git")).toString();
+    auto json = QJsonDocument(QJsonArray {
+      QJsonObject {{ "name", "demo" }, { "url", url }, { "hash", commits[2] }},
+      QJsonObject {{ "name", "missing" }, { "url", missing }, { "hash", commits[2] }},
+    }).toJson(QJsonDocument::Compact);
+    pm.loadSummary(json);
+    QCOMPARE(workspaceContent(), QByteArray("3"));
+    QCOMPARE(recordedHash(), commits[2]);
+    QVERIFY(!pm.getDisabledPacks().contains("demo"));
+    QVERIFY(!QDir("packages/missing").exists());
+  }
+};
+
+QTEST_GUILESS_MAIN(TestPackMan)
+#include "test_packman.moc"
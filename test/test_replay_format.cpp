@@ -0,0 +1,231 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <QTest>
+#include "client/replay_format.h"
+#include "client/replay_reader.h"
+
+#if defined(__GLIBC__)
+// 统计 malloc 次数，看读一个事件要分配几次内存
+extern "C" void *__libc_malloc(size_t size);
+static std::atomic<qint64> mallocCalls = 0;
+extern "C" void *malloc(size_t size) noexcept {
+  mallocCalls.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+#endif
+
+class TestReplayFormat : public QObject {
+  Q_OBJECT
+
+private:
+  QByteArray cbor; // v1 未压缩
+
+  // 造一份结构和真实录像一样的数据：文件头 + 若干事件
+  static QByteArray makeRecording(int events) {
+    static const QList<QByteArray> cmds = {
+      "PropertyUpdate", "MoveCards", "LogEvent", "Animate", "AskForUseCard",
+    };
+    QCborArray arr {
+      QByteArray(FK_VERSION), QByteArray("test.fk.rep"),
+      QCborMap {{ "gameMode", "aaa_role_mode" }}.toCborValue().toCbor(),
+      QCborArray { 1, "self", "avatar" }.toCborValue().toCbor(),
+      0, QByteArray("normal"),
+    };
+    qint64 t = 1700000000000;
+    for (int i = 0; i < events; i++) {
+      t += (i * 37) % 1500;
+      auto data = QCborArray { i % 8, QString("card%1").arg(i % 100), i % 3 == 0 }
+        .toCborValue().toCbor();
+      arr << QCborArray { t, i % 11 == 0, cmds[i % cmds.size()], data };
+    }
+    return arr.toCborValue().toCbor();
+  }
+
+  static QList<ReplayReader::Event> readAll(ReplayReader &r) {
+    QList<ReplayReader::Event> ret;
+    ReplayReader::Event e;
+    while (r.next(e)) {
+      // v2 的参数视图读到下一块就失效了
+      e.data = QByteArray(e.data.constData(), e.data.size());
+      ret << e;
+    }
+    return ret;
+  }
+
+#if defined(__GLIBC__)
+  // 顺序读完整个录像期间的 malloc 次数，不含 open()
+  static qint64 countAllocations(const QByteArray &raw, int &events) {
+    ReplayReader r;
+    if (!r.open(raw)) return -1;
+    ReplayReader::Event e;
+    events = 0;
+    qint64 before = mallocCalls;
+    while (r.next(e)) events++;
+    return mallocCalls - before;
+  }
+#endif
+
+private slots:
+  void initTestCase() {
+    cbor = makeRecording(20000);
+  }
+
+  void roundTrip() {
+    auto v2 = ReplayFormat::encode(cbor, 300);
+    QVERIFY(ReplayFormat::isV2(v2));
+    QCOMPARE(QCborValue::fromCbor(ReplayFormat::toCbor(v2)), QCborValue::fromCbor(cbor));
+    QVERIFY(!ReplayFormat::isV2(qCompress(cbor)));
+    QCOMPARE(ReplayFormat::toCbor(qCompress(cbor)), cbor);
+  }
+
+  void smallerThanV1() {
+    auto v1 = qCompress(cbor);
+    auto v2 = ReplayFormat::encode(cbor);
+    qInfo("v1 %lld bytes, v2 %lld bytes, %.2fx", (qint64)v1.size(), (qint64)v2.size(),
+          double(v1.size()) / v2.size());
+    // 这份合成录像的参数几乎各不相同，按列存储约能小三分之一（约 1.5 倍）；
+    // 真实对局里参数重复多得多。这里守住下限，比例变差说明编码退化了
+    QVERIFY(v2.size() * 4 <= v1.size() * 3);
+  }
+
+  // 无法解析的数据原样按 v1 保存，不能丢
+  void invalidFallsBack() {
+    auto v = ReplayFormat::encode("not cbor");
+    QVERIFY(!ReplayFormat::isV2(v));
+    QCOMPARE(qUncompress(v), QByteArray("not cbor"));
+  }
+
+  void readerSameEvents() {
+    ReplayReader r1, r2;
+    QVERIFY(r1.open(qCompress(cbor)));
+    QVERIFY(r2.open(ReplayFormat::encode(cbor, 300)));
+    QCOMPARE(r2.version, r1.version);
+    QCOMPARE(r2.roomSettings, r1.roomSettings);
+    QCOMPARE(r2.playerInfo, r1.playerInfo);
+    QCOMPARE(r2.recordType, QByteArray("normal"));
+
+    auto a = readAll(r1), b = readAll(r2);
+    QCOMPARE(a.size(), 20000);
+    QCOMPARE(b.size(), a.size());
+    for (int i = 0; i < a.size(); i++) {
+      QCOMPARE(b[i].elapsed, a[i].elapsed);
+      QCOMPARE(b[i].isRequest, a[i].isRequest);
+      QCOMPARE(b[i].cmd, a[i].cmd);
+      QCOMPARE(b[i].data, a[i].data);
+    }
+  }
+
+  void indexAndSeek() {
+    for (auto raw : { qCompress(cbor), ReplayFormat::encode(cbor, 300) }) {
+      ReplayReader r;
+      QVERIFY(r.open(raw));
+      std::atomic_bool cancel = false;
+      r.buildIndex(cancel);
+      QVERIFY(r.indexReady());
+      QCOMPARE(r.index().size(), 20000);
+
+      auto &entry = r.index().at(12345);
+      r.seek(entry.offset);
+      ReplayReader::Event e, at;
+      QVERIFY(r.next(e));
+      QCOMPARE(e.elapsed, entry.elapsed);
+      QVERIFY(r.readAt(entry.offset, at));
+      QCOMPARE(at.data, e.data);
+
+      r.rewind();
+      QVERIFY(r.next(e));
+      QCOMPARE(e.elapsed, r.index().first().elapsed);
+    }
+  }
+
+  void timeRange() {
+    ReplayReader v1;
+    QVERIFY(v1.open(qCompress(cbor)));
+    auto all = readAll(v1);
+    for (auto raw : { qCompress(cbor), ReplayFormat::encode(cbor, 300) }) {
+      ReplayReader r;
+      QVERIFY(r.open(raw));
+      qint64 first = 0, last = 0;
+      QVERIFY(r.timeRange(first, last));
+      QCOMPARE(first, all.first().elapsed);
+      QCOMPARE(last, all.last().elapsed);
+    }
+  }
+
+  void corrupted() {
+    auto v2 = ReplayFormat::encode(cbor, 300);
+    v2[v2.size() / 2] = v2[v2.size() / 2] ^ 0x5a;
+    ReplayReader r;
+    if (r.open(v2)) {
+      // 坏块读到为止，不能崩
+      readAll(r);
+    }
+    QCOMPARE(ReplayFormat::toCbor(v2.left(v2.size() - 1)), QByteArray());
+  }
+
+  void allocations() {
+#if defined(__GLIBC__)
+    // 事件的命令和参数都是视图：v1 只剩每个事件一个 QCborStreamReader，
+    // v2 只有每块解压时的几次
+    int events = 0;
+    auto v1 = countAllocations(qCompress(cbor), events);
+    QCOMPARE(events, 20000);
+    auto v2 = countAllocations(ReplayFormat::encode(cbor, 512), events);
+    QCOMPARE(events, 20000);
+    qInfo("allocations for 20000 events: v1 %lld, v2 %lld", v1, v2);
+    QVERIFY(v1 <= 20000 * 2);
+    QVERIFY(v2 < 20000 / 512 * 10 + 100);
+#else
+    QSKIP("malloc counting needs glibc");
+#endif
+  }
+
+  // FK_REPLAY_CORPUS 指向一个放着 .fk.rep 的目录时，统计真实录像的载入耗时和分配次数
+  void benchCorpus() {
+#if defined(__GLIBC__)
+    auto dir = qEnvironmentVariable("FK_REPLAY_CORPUS");
+    if (dir.isEmpty()) QSKIP("FK_REPLAY_CORPUS not set");
+
+    qint64 files = 0, events = 0, allocs = 0, bytes = 0;
+    QElapsedTimer timer;
+    timer.start();
+    for (auto &info : QDir(dir).entryInfoList({ "*.fk.rep" }, QDir::Files)) {
+      QFile f(info.absoluteFilePath());
+      if (!f.open(QIODevice::ReadOnly)) continue;
+      auto raw = f.readAll();
+      int n = 0;
+      auto a = countAllocations(raw, n);
+      if (a < 0) continue;
+      files++;
+      events += n;
+      allocs += a;
+      bytes += raw.size();
+    }
+    qInfo("%lld files, %lld bytes, %lld events, %lld ms, %lld allocations while reading",
+          files, bytes, events, timer.elapsed(), allocs);
+#else
+    QSKIP("malloc counting needs glibc");
+#endif
+  }
+
+  void benchLoadV1() {
+    auto raw = qCompress(cbor);
+    QBENCHMARK {
+      ReplayReader r;
+      r.open(raw);
+      readAll(r);
+    }
+  }
+
+  void benchLoadV2() {
+    auto raw = ReplayFormat::encode(cbor);
+    QBENCHMARK {
+      ReplayReader r;
+      r.open(raw);
+      readAll(r);
+    }
+  }
+};
+
+QTEST_GUILESS_MAIN(TestReplayFormat)
+#include "test_replay_format.moc"
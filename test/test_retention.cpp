@@ -0,0 +1,203 @@
+// SPDX-License-Identifier: GPL-3.0-or-later
+
+#include <QTest>
+#include <QSignalSpy>
+#include "client/retention.h"
+#include "core/c-wrapper.h"
+
+// c-wrapper.cpp 里的 Lua 要用 swig 生成的绑定，这里只用到 Sqlite3
+extern "C" int luaopen_fk(lua_State *) { return 0; }
+
+class TestRetention : public QObject {
+  Q_OBJECT
+
+private:
+  std::unique_ptr<QTemporaryDir> dir;
+  std::unique_ptr<Sqlite3> db;
+  QString dbPath;
+
+  // id 为 [from, to] 的对局各存一份录像和复盘资料，大小分别为 recSize、roomSize
+  void insertGames(int from, int to, int recSize = 100, int roomSize = 50) {
+    static auto sql = QString(
+      "WITH RECURSIVE s(i) AS (SELECT %1 UNION ALL SELECT i + 1 FROM s WHERE i < %2) "
+      "INSERT INTO %3 SELECT i, zeroblob(%4) FROM s;");
+    QVERIFY(db->exec("BEGIN;"));
+    QVERIFY(db->exec(sql.arg(from).arg(to).arg("myGameRecordings").arg(recSize)));
+    QVERIFY(db->exec(sql.arg(from).arg(to).arg("myGameRoomData").arg(roomSize)));
+    QVERIFY(db->exec("COMMIT;"));
+  }
+
+  int value(const QString &sql) {
+    auto ret = db->select(sql);
+    return ret.isEmpty() ? -1 : ret[0].first().toInt();
+  }
+
+  int count(const QString &table) {
+    return value(QString("SELECT count() FROM %1;").arg(table));
+  }
+
+  int minId(const QString &table) {
+    return value(QString("SELECT min(id) FROM %1;").arg(table));
+  }
+
+  int watermark(const QString &table) {
+    return value(QString("SELECT value FROM clientMeta WHERE key = 'retention.%1';").arg(table));
+  }
+
+  void clean(RecordingRetention &r, const RecordingRetention::Limits &l) {
+    r.setLimits(l);
+    r.schedule();
+    r.wait();
+  }
+
+private slots:
+  void init() {
+    dir = std::make_unique<QTemporaryDir>();
+    QVERIFY(dir->isValid());
+    dbPath = dir->filePath("client.db");
+    db = std::make_unique<Sqlite3>(dbPath, FK_SOURCE_DIR "/client/init.sql");
+  }
+
+  void cleanup() {
+    db.reset();
+    dir.reset();
+  }
+
+  void countLimit() {
+    insertGames(1, 100);
+    RecordingRetention r(dbPath);
+    RecordingRetention::Limits l;
+    l.maxRecordings = 30;
+    l.maxRoomData = 50;
+    l.batchSize = 7; // 不整除，最后一批是零头
+    QSignalSpy spy(&r, &RecordingRetention::cleaned);
+    clean(r, l);
+
+    QCOMPARE(count("myGameRecordings"), 30);
+    QCOMPARE(minId("myGameRecordings"), 71);
+    QCOMPARE(count("myGameRoomData"), 50);
+    QCOMPARE(minId("myGameRoomData"), 51);
+    QCOMPARE(watermark("myGameRecordings"), 70);
+    QCOMPARE(watermark("myGameRoomData"), 50);
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(spy[0][0].toInt(), 70);
+    QCOMPARE(spy[0][1].toInt(), 50);
+
+    // 大小统计跟着清掉：两边都删了的行整行删除，只删了录像的把那一列置0
+    QCOMPARE(count("myGameBlobSize"), 50);
+    QCOMPARE(value("SELECT count() FROM myGameBlobSize WHERE recording = 0;"), 20);
+  }
+
+  void byteLimit() {
+    insertGames(1, 100); // 每局 150 字节
+    RecordingRetention r(dbPath);
+    RecordingRetention::Limits l;
+    l.maxBytes = 1500;
+    clean(r, l);
+
+    // 最新的 10 局正好 1500 字节，第 11 局起超出
+    QCOMPARE(count("myGameRecordings"), 10);
+    QCOMPARE(minId("myGameRecordings"), 91);
+    QCOMPARE(count("myGameRoomData"), 10);
+    QCOMPARE(value("SELECT SUM(recording + room_data) FROM myGameBlobSize;"), 1500);
+
+    // 行数和字节两条规则取删得多的那个
+    insertGames(101, 120);
+    l.maxBytes = 6000;
+    l.maxRecordings = 5;
+    clean(r, l);
+    QCOMPARE(count("myGameRecordings"), 5);
+    QCOMPARE(count("myGameRoomData"), 30);
+  }
+
+  void watermarkResume() {
+    insertGames(1, 100);
+    RecordingRetention r(dbPath);
+    RecordingRetention::Limits l;
+    l.maxRecordings = 50;
+    l.maxRoomData = 50;
+    l.batchSize = 16;
+    clean(r, l);
+    QCOMPARE(watermark("myGameRecordings"), 50);
+
+    // 再来 20 局，只需要从水位线往后删
+    QSignalSpy spy(&r, &RecordingRetention::cleaned);
+    insertGames(101, 120);
+    clean(r, l);
+    QCOMPARE(watermark("myGameRecordings"), 70);
+    QCOMPARE(minId("myGameRecordings"), 71);
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(spy[0][0].toInt(), 20);
+
+    // 没有新数据时什么也不做
+    clean(r, l);
+    QCOMPARE(spy.count(), 1);
+    QCOMPARE(watermark("myGameRecordings"), 70);
+  }
+
+  // 从旧版本升级上来时没有水位线，表里最小的 id 很大，要跳过前面的空档
+  void watermarkSkipsGap() {
+    insertGames(100001, 100100);
+    RecordingRetention r(dbPath);
+    RecordingRetention::Limits l;
+    l.maxRecordings = 10;
+    l.batchSize = 5;
+    QElapsedTimer timer;
+    timer.start();
+    clean(r, l);
+    QCOMPARE(count("myGameRecordings"), 10);
+    QCOMPARE(watermark("myGameRecordings"), 100090);
+    // 从 0 开始每批 5 个 id 走过去要两万个事务
+    QVERIFY(timer.elapsed() < 5000);
+  }
+
+  void starredSurvive() {
+    insertGames(1, 100);
+    QVERIFY(db->exec("INSERT INTO starredRecording (id, replay_name, my_comment) VALUES "
+                     "(10, 'a.fk.rep', ''), (20, 'b.fk.rep', ''), (NULL, 'c.fk.rep', '');"));
+    RecordingRetention r(dbPath);
+    RecordingRetention::Limits l;
+    l.maxRecordings = 30;
+    l.maxRoomData = 30;
+    l.batchSize = 8;
+    QSignalSpy spy(&r, &RecordingRetention::cleaned);
+    clean(r, l);
+
+    QCOMPARE(count("myGameRecordings"), 32);
+    QCOMPARE(count("myGameRoomData"), 32);
+    QCOMPARE(value("SELECT count() FROM myGameRecordings WHERE id IN (10, 20);"), 2);
+    QCOMPARE(value("SELECT count() FROM myGameRoomData WHERE id IN (10, 20);"), 2);
+    QCOMPARE(value("SELECT recording FROM myGameBlobSize WHERE id = 10;"), 100);
+    QCOMPARE(spy[0][0].toInt(), 68);
+    QCOMPARE(watermark("myGameRecordings"), 70);
+
+    // 收藏的不计入总大小，也不会因为超出被删
+    l.maxRecordings = 5000;
+    l.maxRoomData = 50000;
+    l.maxBytes = 300;
+    clean(r, l);
+    QCOMPARE(count("myGameRecordings"), 4);
+    QCOMPARE(minId("myGameRecordings"), 10);
+    QCOMPARE(value("SELECT count() FROM myGameRecordings WHERE id > 20;"), 2);
+  }
+
+  // 收藏的不占行数额度：收藏了最新的两局，照样还要留 30 局没收藏的
+  void starredNotCounted() {
+    insertGames(1, 100);
+    QVERIFY(db->exec("INSERT INTO starredRecording (id, replay_name, my_comment) VALUES "
+                     "(99, 'a.fk.rep', ''), (100, 'b.fk.rep', '');"));
+    RecordingRetention r(dbPath);
+    RecordingRetention::Limits l;
+    l.maxRecordings = 30;
+    l.maxRoomData = 30;
+    clean(r, l);
+
+    QCOMPARE(count("myGameRecordings"), 32);
+    QCOMPARE(minId("myGameRecordings"), 69);
+    QCOMPARE(count("myGameRoomData"), 32);
+    QCOMPARE(watermark("myGameRecordings"), 68);
+  }
+};
+
+QTEST_GUILESS_MAIN(TestRetention)
+#include "test_retention.moc"